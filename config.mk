@@ -23,6 +23,11 @@ export LDFLAGS = \
 	-L toolchain/$(TARGET)/lib/gcc/$(TARGET)/$(GCC_VERSION) \
 	-lgcc
 
+# build with `make BENCH=1` to run the in-kernel benchmarks at boot
+ifdef BENCH
+CFLAGS += -D BENCH
+endif
+
 export INCLUDE = \
 	-I include \
 	-I lib/libc/include
@@ -0,0 +1,19 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: bench.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: in-kernel microbenchmarks, built with `make BENCH=1`
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <maestro.h>
+
+#include <clk.h>
+
+void bench();
+
+#endif    // BENCH_H
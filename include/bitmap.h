@@ -13,37 +13,47 @@
 
 #include <maestro.h>
 
-void BITMAP_SET(u32 *bitmap, int bit)
+static inline void BITMAP_SET(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
-	u32 flag = 1 << pos;
+	u32 flag = 1u << pos;
 	bitmap[i] |= flag;
 }
 
-void BITMAP_CLEAR(u32 *bitmap, int bit)
+static inline void BITMAP_CLEAR(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
-	u32 flag = 1 << pos;
+	u32 flag = 1u << pos;
 	bitmap[i] &= ~flag;
 }
 
-bool BITMAP_TEST(u32 *bitmap, int bit)
+static inline bool BITMAP_TEST(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
-	uint flag = 1 << pos;
+	uint flag = 1u << pos;
 	return (bitmap[i] & flag) != 0;
 }
 
+/**
+ * @brief index of the lowest set bit of a word
+ * compiles down to a single bsf (or tzcnt) instruction
+ * @param word word to scan, must not be 0
+ */
+static inline int BITMAP_FFS(u32 word)
+{
+	return __builtin_ctz(word);
+}
+
 /**
  * @brief finds the first set bit of a bitmap
  * @param bitmap a pointer to the bitmap
  * @param max_bits the maximum bit index this bitmap keeps track of
  * @return index of first set bit or -1 if all are clear
  */
-int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
+static inline int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
 {
 	for (int i = 0; i < max_bits / 32; ++i)
 	{
@@ -52,12 +62,7 @@ int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
 			continue;
 
 		// at least one of the bits in this u32 are set so find it
-		for (int j = 0; j < 32; ++j)
-		{
-			int bit = i * 32 + j;
-			if (BITMAP_TEST(bitmap, bit))
-				return bit;
-		}
+		return i * 32 + BITMAP_FFS(bitmap[i]);
 	}
 
 	return -1;
@@ -69,7 +74,7 @@ int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
  * @param max_bits the maximum bit index this bitmap keeps track of
  * @return index of first clear bit or -1 if all are set
  */
-int BITMAP_FIRST_CLEAR(u32 *bitmap, int max_bits)
+static inline int BITMAP_FIRST_CLEAR(u32 *bitmap, int max_bits)
 {
 	for (int i = 0; i < max_bits / 32; ++i)
 	{
@@ -78,12 +83,149 @@ int BITMAP_FIRST_CLEAR(u32 *bitmap, int max_bits)
 			continue;
 
 		// at least one of the bits in this u32 are clear so find it
-		for (int j = 0; j < 32; ++j)
+		return i * 32 + BITMAP_FFS(~bitmap[i]);
+	}
+
+	return -1;
+}
+
+/**
+ * @brief a bitmap with two levels of summary bitmaps above it
+ *
+ * bit n of l1 is set when word n of l0 has any bit set,
+ * and bit n of l2 is set when word n of l1 has any bit set.
+ * so one l2 word summarizes 32768 bits, and finding a set bit never
+ * has to look at more than one word of l0 or l1. with 32 bit words,
+ * a bitmap of 1M bits (4G worth of blocks) has only 32 words of l2 to search.
+ */
+struct hbitmap
+{
+	u32 *l0;
+	u32 *l1;
+	u32 *l2;
+	u32 nbits;
+	u32 hint;    // where the next search begins
+};
+
+/**
+ * @brief number of bytes needed to back a hierarchical bitmap
+ * @param nbits number of bits in the bitmap
+ */
+static inline u32 hbitmap_size(u32 nbits)
+{
+	u32 w0 = (nbits + 31) / 32;
+	u32 w1 = (w0 + 31) / 32;
+	u32 w2 = (w1 + 31) / 32;
+	return (w0 + w1 + w2) * sizeof(u32);
+}
+
+/**
+ * @brief sets up a hierarchical bitmap with every bit clear
+ * @param hb bitmap to initialize
+ * @param mem hbitmap_size(nbits) bytes of memory to back the bitmap
+ * @param nbits number of bits in the bitmap
+ */
+static inline void hbitmap_init(struct hbitmap *hb, void *mem, u32 nbits)
+{
+	u32 w0 = (nbits + 31) / 32;
+	u32 w1 = (w0 + 31) / 32;
+	u32 w2 = (w1 + 31) / 32;
+
+	hb->l0    = (u32 *) mem;
+	hb->l1    = hb->l0 + w0;
+	hb->l2    = hb->l1 + w1;
+	hb->nbits = nbits;
+	hb->hint  = 0;
+
+	for (u32 i = 0; i < w0 + w1 + w2; i++)
+		hb->l0[i] = 0;
+}
+
+static inline bool hbitmap_test(struct hbitmap *hb, u32 bit)
+{
+	return BITMAP_TEST(hb->l0, bit);
+}
+
+static inline void hbitmap_set(struct hbitmap *hb, u32 bit)
+{
+	u32 w0 = bit / 32;
+	u32 w1 = w0 / 32;
+
+	// only the first bit set in a word has to be propagated upwards
+	if (hb->l0[w0] == 0)
+	{
+		if (hb->l1[w1] == 0)
+			BITMAP_SET(hb->l2, w1);
+
+		BITMAP_SET(hb->l1, w0);
+	}
+
+	BITMAP_SET(hb->l0, bit);
+}
+
+static inline void hbitmap_clear(struct hbitmap *hb, u32 bit)
+{
+	u32 w0 = bit / 32;
+	u32 w1 = w0 / 32;
+
+	BITMAP_CLEAR(hb->l0, bit);
+
+	// and only the last bit cleared in a word
+	if (hb->l0[w0] == 0)
+	{
+		BITMAP_CLEAR(hb->l1, w0);
+
+		if (hb->l1[w1] == 0)
+			BITMAP_CLEAR(hb->l2, w1);
+	}
+}
+
+// mask of every bit at or above pos in a word
+static inline u32 bits_from(u32 pos)
+{
+	return pos >= 32 ? 0 : ~0u << pos;
+}
+
+/**
+ * @brief finds the first set bit of a hierarchical bitmap, starting at its hint
+ * and wrapping around to the beginning
+ * @param hb bitmap to search
+ * @return index of the set bit, or -1 if every bit is clear
+ */
+static inline int hbitmap_find(struct hbitmap *hb)
+{
+	u32 from = hb->hint < hb->nbits ? hb->hint : 0;
+	u32 w0   = from / 32;
+	u32 w1   = w0 / 32;
+	u32 w2   = w1 / 32;
+	u32 nw2  = (hb->nbits + 32 * 32 * 32 - 1) / (32 * 32 * 32);
+	u32 bits;
+
+	// rest of the l0 word the hint is in
+	bits = hb->l0[w0] & bits_from(from % 32);
+	if (bits)
+		return w0 * 32 + BITMAP_FFS(bits);
+
+	// rest of the l1 word the hint is in
+	bits = hb->l1[w1] & bits_from(w0 % 32 + 1);
+	if (bits)
+	{
+		w0 = w1 * 32 + BITMAP_FFS(bits);
+		return w0 * 32 + BITMAP_FFS(hb->l0[w0]);
+	}
+
+	// rest of the l2 word the hint is in, then every l2 word after it, then wrap around
+	bits = hb->l2[w2] & bits_from(w1 % 32 + 1);
+	for (u32 i = 0; i <= nw2; i++)
+	{
+		if (bits)
 		{
-			int bit = i * 32 + j;
-			if (!BITMAP_TEST(bitmap, bit))
-				return bit;
+			w1 = ((w2 + i) % nw2) * 32 + BITMAP_FFS(bits);
+			w0 = w1 * 32 + BITMAP_FFS(hb->l1[w1]);
+			return w0 * 32 + BITMAP_FFS(hb->l0[w0]);
 		}
+
+		bits = hb->l2[(w2 + i + 1) % nw2];
 	}
 
 	return -1;
@@ -12,7 +12,26 @@
 
 #include <maestro.h>
 
+struct proc;
+
+/**
+ * @brief reads the cpu's timestamp counter
+ */
+static inline u64 rdtsc()
+{
+	u32 lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((u64) hi << 32) | lo;
+}
+
 void clk_init();
+void clk_idle();
+void clk_resume();
+u32 uptime_ms();
+u64 clock_ns();
+u32 tsc_khz();
+void udelay(u32);
 void sleepms(uint);
+bool unsleep(struct proc *);
 
 #endif    // CLK_H
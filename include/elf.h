@@ -47,6 +47,14 @@ struct elf_phdr
 	u32 p_align;
 };
 
+// segment types
+#define PT_LOAD 1
+
+// segment permissions
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
 void run_elf();
 void print_elf(struct elf_ehdr *);
 
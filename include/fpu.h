@@ -0,0 +1,25 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: fpu.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: lazy switching of fpu and sse state between processes
+ */
+#ifndef FPU_H
+#define FPU_H
+
+#include <maestro.h>
+
+// size of the area fxsave saves the x87 fpu, mmx, and sse registers to
+#define FXSAVE_SIZE 512
+
+struct proc;
+
+void fpu_init();
+void fpu_switch(struct proc *, struct proc *);
+void fpu_fork(struct proc *, struct proc *);
+void fpu_exit(struct proc *);
+
+#endif    // FPU_H
@@ -31,6 +31,10 @@
 
 #define SYSCALL        48    // system call interrupt number
 
+#define LAPIC_TIMER    49    // local apic timer, which drives the scheduler on every cpu but the boot cpu
+#define IPI_RESCHED    50    // sent to an idle cpu when another cpu readies a process on it
+#define LAPIC_SPURIOUS 255   // spurious interrupt from the local apic
+
 // state of the registers pushed on the stack when an interrupt occurs 
 // see isr_common in intr.s
 struct registers
@@ -55,6 +59,7 @@ struct registers
 // defined in intr.s
 void intr_init();
 extern void set_vect(u8, void (*)(void));
+void set_xint(u8, bool (*)(struct registers *));
 extern int disable();
 extern void restore(int);
 
@@ -15,6 +15,9 @@
 #define NUM_KEYS     128
 #define KBD_IN       0x60
 
+// number of scancodes the interrupt handler can buffer before they are decoded, a power of 2
+#define KBD_BUFSIZE  64
+
 // indices of special keys in LUT
 #define ESC_IDX      1
 #define LCTRL_IDX    28
@@ -56,6 +59,7 @@ static const char kbdus[NUM_KEYS] = {
 	'\0', '\0', '\0', '\0', '\0', '\0', '\0', '\0',
 };
 
+void kbd_init();
 void kbdhandler();
 
 #endif    // KBD_H
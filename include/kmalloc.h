@@ -12,9 +12,19 @@
 
 #include <maestro.h>
 
+struct meminfo;
+
 // minimum size in bytes that can be kmalloc'd
 #define MIN_ALLOCATION    8
 
+// size in bytes of the kernel heap arena
+#define KHEAP_SIZE        (1024 * 1024)
+
+// number of segregated freelists
+// lists 0 through N_LISTS - 2 each hold blocks of exactly one size,
+// in steps of 8 bytes. the final list holds every block too large for the others
+#define N_LISTS           64
+
 // size of the header for an allocated block
 #define ALLOC_HEADER_SIZE (sizeof(struct header) - (2 * sizeof(struct header *)))
 
@@ -26,6 +36,7 @@ enum state
 	UNALLOCATED = 0,
 	ALLOCATED   = 1,
 	SENTINAL    = 2,
+	FENCEPOST   = 3,    // marks the edges of the heap so blocks are never coalesced past them
 };
 
 /**
@@ -118,6 +129,7 @@ void kmalloc_init(void *, size_t);
 void *kmalloc(size_t);
 void *kmalloc_a(size_t, size_t);
 void kfree(void *);
+void kmalloc_meminfo(struct meminfo *);
 
 void print_heap();
 void print_freelist();
@@ -0,0 +1,46 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: meminfo.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: memory usage counters reported by the meminfo syscall
+ *
+ * Each memory subsystem keeps its own counters up to date as it allocates and frees,
+ * and copies them into a struct meminfo when asked. This layout is shared with
+ * libc's sys/meminfo.h, so the two have to be changed together.
+ */
+#ifndef MEMINFO_H
+#define MEMINFO_H
+
+#include <maestro.h>
+
+// number of size classes kmalloc usage is broken down into
+// class 0 holds blocks of up to KMALLOC_CLASS_MIN bytes, and each class after it
+// holds blocks up to twice as large as the one before. the final class holds everything larger
+#define KMALLOC_NCLASSES  8
+
+// largest block size in bytes counted in kmalloc size class 0
+#define KMALLOC_CLASS_MIN 32
+
+struct meminfo
+{
+	u32 total_frames;                       // frames of physical memory the pmm manages
+	u32 free_frames;                        // frames that can be allocated, including the zero pool
+	u32 used_frames;                        // frames currently allocated
+	u32 zeroed_frames;                      // free frames that are already zeroed
+	u32 page_table_pages;                   // frames holding page directories and page tables
+
+	u32 kheap_size;                         // size in bytes of the kernel heap arena
+	u32 kmalloc_bytes[KMALLOC_NCLASSES];    // bytes allocated from the kernel heap, by size class
+	u32 kmalloc_count[KMALLOC_NCLASSES];    // blocks allocated from the kernel heap, by size class
+
+	u32 slab_caches;                        // number of slab caches
+	u32 slab_pages;                         // pages owned by every slab cache
+	u32 slab_bytes;                         // bytes of objects allocated from slab caches
+
+	u32 resident_pages;                     // user pages mapped in by the process that was asked about
+};
+
+#endif    // MEMINFO_H
@@ -17,6 +17,8 @@
 
 #include <maestro.h>
 
+struct meminfo;
+
 // size of a physical memory block in bytes
 #define BLOCK_SIZE     4096
 
@@ -26,10 +28,28 @@
 // magic number bootloader uses to signify the end of the memory map
 #define MMAP_MAGIC     0xcafebabe
 
+// largest order the buddy allocator manages - 2^10 blocks is 4M
+#define PMM_MAX_ORDER  10
+
+// memory below this physical address is never handed out
+#define LOW_RESERVED   0x10000
+
+// number of pre-zeroed blocks the idle process keeps ready for pmm_alloc_zeroed()
+#define ZERO_POOL_SIZE 64
+
 // rounds a number up to the nearest block alignment
 #define BLOCK_ALIGN(n) ((n + (BLOCK_SIZE - 1)) & -BLOCK_SIZE)
 
 void pmm_init();
 uintptr_t pmm_alloc();
+uintptr_t pmm_alloc_order(uint);
+uintptr_t pmm_alloc_zeroed();
+bool pmm_refill_zero_pool();
+void pmm_free(uintptr_t);
+void pmm_free_order(uintptr_t, uint);
+uintptr_t pmm_mem_end();
+void pmm_ref(uintptr_t);
+uint pmm_refcount(uintptr_t);
+void pmm_meminfo(struct meminfo *);
 
 #endif    // PMM_H
@@ -6,19 +6,37 @@
  * FILE: pq.h
  * DATE: April 4th, 2022
  * DESCRIPTION: Priority queue implementation
+ *
+ * A binary min-heap of intrusive nodes. Anything that can be queued embeds a struct pqnode,
+ * and the heap is an array of pointers to those nodes, provided by the owner of the queue,
+ * so pushing never allocates memory. Each node remembers where it is in the heap, so
+ * push, pop, and removing any node are all O(log n).
  */
 #ifndef PQ_H
 #define PQ_H
 
+#include <maestro.h>
+
+struct pqnode
+{
+	u32 key;      // smallest key is at the front of the queue
+	uint index;   // position of the node in the heap
+};
+
 struct pq
 {
-	void *data;
-	struct pq *next;
+	struct pqnode **heap;
+	uint count;
+	uint capacity;
 };
 
-void push(struct pq **, void *, int (*)(void *, void *));
-struct pq *pop(struct pq **);
-void *peek(struct pq **);
-struct pq *newpq();
+// gets a pointer to the struct of the given type that a pqnode is embedded in as member
+#define pq_entry(node, type, member) ((type *) ((u8 *) (node) - offsetof(type, member)))
+
+void pq_init(struct pq *, struct pqnode **, uint);
+bool push(struct pq *, struct pqnode *);
+struct pqnode *pop(struct pq *);
+struct pqnode *peek(struct pq *);
+void pq_remove(struct pq *, struct pqnode *);
 
 #endif    // PQ_H
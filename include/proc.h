@@ -11,6 +11,11 @@
 #define PROC_H
 
 #include <maestro.h>
+#include <intr.h>
+#include <pq.h>
+#include <queue.h>
+#include <smp.h>
+#include <spinlock.h>
 #include <vfs.h>
 
 // max number of processes (for now),
@@ -21,6 +26,28 @@
 
 #define PR_STACKSIZE 4096
 
+// address of the top of every user stack, just below the page holding the process's arguments
+#define USTACK_TOP   (0xc0000000 - PR_STACKSIZE)
+
+// largest size in bytes a user stack may grow to
+#define USTACK_MAX   (8 * 1024 * 1024)
+
+// number of priority levels of the multi-level feedback queue, level 0 is the highest
+#define NPRIO          8
+
+// ms of cpu time a process may use at one level before it is demoted to the next one down
+#define MLFQ_ALLOTMENT 50
+
+// length in ms of a time slice at the highest priority level
+// see sched_quantum in sched.c for the other levels
+#define QUANTUM_MS     10
+
+// every process is moved back up to its base level this often (in ms), so none of them starve
+#define MLFQ_BOOST_MS  1000
+
+// each cpu evens out its load with the busiest cpu this often (in ms)
+#define BALANCE_MS     20
+
 enum prstate
 {
 	PR_READY,
@@ -37,25 +64,70 @@ struct proc
 	uintptr_t stkbtm;              // address of bottom of kernel stack
 	uintptr_t pdir;                // physical address of page directory
 	enum prstate state;
+	struct qnode qlink;            // link in the ready queue or semaphore wait queue the process is in
+	int cpu;                       // cpu whose run queue the process is readied on, the last one it ran on, or -1
 	u8 kstack[PR_STACKSIZE];       // per process kernel stack
 	void *ustack;                  // user stack
+	struct vm_region *regions;     // user memory regions, sorted by address
+	uintptr_t brk_start;           // start of the heap, just past the elf's highest segment
+	uintptr_t brk;                 // program break, the end of the heap
 	int pid;                       // process id
+	int prio;                      // current priority level, 0 is the highest
+	int nice;                      // base priority level, the highest level the process can reach
+	u32 ticks;                     // ms of cpu time used at its current priority level
+	u32 slice;                     // ms left in the current time slice
+	u32 cputime;                   // total ms of cpu time used
+	u32 dispatched;                // timestamp when the process was last switched to
 	int mask;                      // interrupt state mask
+	void *fpu;                     // fxsave area, allocated the first time the process uses the fpu
+	int fpu_cpu;                   // cpu the process last had the fpu on, or -1
+	int status;                    // exit status, once the process has exited
+	struct proc *joiner;           // process waiting in kthread_join() for this one to exit
+	bool joinable;                 // freed by kthread_join() rather than as soon as it exits
 	struct file *ofile[NOFILE];    // open file table
-	u32 wakeup;                    // timestamp to wake up process when sleeping
+	struct pqnode sleepnode;       // link in the sleep queue, keyed by the timestamp to wake up at
 	char name[32];
 };
 
+// a cpu's ready processes, with a queue for each priority level.
+// a process is readied on the cpu it last ran on, while that cpu's caches still hold its memory
+struct runq
+{
+	struct queue level[NPRIO];
+	uint nready;                   // number of processes in all levels
+};
+
+extern struct runq runqs[NCPU];
+
 // defined in ctxsw.s
 extern void ctxsw(void *, void *);
+extern void proc_entry();
+
+// protects the ready queues, the sleep queue, the process table, and the state of every process.
+// sched() switches processes while holding it, and the process switched to releases it
+extern struct spinlock sched_lock;
 
 // defined in sched.c
 void sched();
+void sched_entry();
+void sched_boost();
+void sched_tick();
+void sched_wakeup();
+uint cpu_load(int);
+int least_loaded_cpu();
+extern u32 sched_quantum[];
 
 void proc_init();
 struct proc *create(void (*func)(void), const char *);
 struct proc *create_usermode(const char *);
 void ready(struct proc *);
+struct proc *fork(struct registers *);
+struct proc *find_proc(int);
+int proc_nice(struct proc *, int);
 void proc_exit(int);
+void proc_free(struct proc *);
+struct proc *kthread_create(int (*)(void *), void *, const char *);
+int kthread_join(struct proc *);
+void kthread_exit(int);
 
 #endif    // PROC_H
@@ -6,6 +6,11 @@
  * FILE: queue.h
  * DATE: March 30th, 2022
  * DESCRIPTION: queue data structure
+ *
+ * Queues are intrusive: anything that can be queued embeds a struct qnode, and the queue
+ * links those nodes together directly. So queueing never allocates memory, and every
+ * operation, including removing a node from the middle of a queue, is O(1).
+ * A node can only be in one queue at a time.
  */
 #ifndef QUEUE_H
 #define QUEUE_H
@@ -14,19 +19,72 @@
 
 struct qnode
 {
-	void *data;
 	struct qnode *next;
+	struct qnode *prev;
 };
+
 struct queue
 {
 	uint count;
-    struct qnode *front;
-    struct qnode *rear;
+	struct qnode head;    // sentinal - head.next is the front of the queue and head.prev is the rear
 };
 
-void insert(struct queue *, void *);
-void *dequeue(struct queue *);
-struct queue *newq();
-bool is_empty(struct queue *);
+// gets a pointer to the struct of the given type that a qnode is embedded in as member
+#define queue_entry(node, type, member) ((type *) ((u8 *) (node) - offsetof(type, member)))
+
+static inline void queue_init(struct queue *q)
+{
+	q->count     = 0;
+	q->head.next = &q->head;
+	q->head.prev = &q->head;
+}
+
+static inline bool is_empty(struct queue *q)
+{
+	return q->count == 0;
+}
+
+/**
+ * @brief adds a node to the rear of a queue
+ * @param q queue to add to
+ * @param node node to add, which must not already be in a queue
+ */
+static inline void insert(struct queue *q, struct qnode *node)
+{
+	node->next         = &q->head;
+	node->prev         = q->head.prev;
+	q->head.prev->next = node;
+	q->head.prev       = node;
+	q->count++;
+}
+
+/**
+ * @brief unlinks a node from anywhere in a queue
+ * @param q queue the node is in
+ * @param node node to remove
+ */
+static inline void queue_remove(struct queue *q, struct qnode *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next       = NULL;
+	node->prev       = NULL;
+	q->count--;
+}
+
+/**
+ * @brief removes the node at the front of a queue
+ * @param q queue to remove from
+ * @return the removed node, or NULL if the queue is empty
+ */
+static inline struct qnode *dequeue(struct queue *q)
+{
+	if (is_empty(q))
+		return NULL;
+
+	struct qnode *node = q->head.next;
+	queue_remove(q, node);
+	return node;
+}
 
 #endif // QUEUE_H
@@ -16,7 +16,7 @@
 struct sem
 {
 	int count;
-	struct queue *waitq;
+	struct queue waitq;
 };
 
 void sem_init();
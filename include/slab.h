@@ -0,0 +1,76 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: slab.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: slab allocator for fixed size kernel objects
+ */
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <maestro.h>
+
+struct meminfo;
+
+// base of the kernel virtual region slabs are mapped into
+#define KSLAB_BASE      0xd0000000
+
+// size in bytes of the kernel virtual region slabs are mapped into
+#define KSLAB_SIZE      0x10000000
+
+// the largest number of pages a single slab may span
+#define SLAB_MAX_PAGES  8
+
+// a slab tries to hold at least this many objects before it is considered big enough
+#define SLAB_MIN_OBJS   8
+
+/**
+ * @brief a run of pages carved into equally sized objects
+ *
+ * the slab header lives at the very beginning of its first page, and slabs are
+ * aligned to their own size, so the slab an object belongs to can always be found
+ * by masking off the low bits of the object's address
+ */
+struct slab
+{
+	struct kmem_cache *cache;    // cache this slab belongs to
+	struct slab *next;           // next slab in the cache's list
+	struct slab *prev;           // previous slab in the cache's list
+	void *freelist;              // first free object in this slab
+	uint inuse;                  // number of allocated objects in this slab
+};
+
+/**
+ * @brief a cache of objects which are all the same type
+ */
+struct kmem_cache
+{
+	const char *name;
+	size_t objsize;              // size in bytes of each object
+	size_t stride;               // distance in bytes between consecutive objects
+	size_t free_off;             // offset into a free object where the next free ptr is stored
+	size_t slab_size;            // size in bytes of each slab
+	uint objs_per_slab;          // number of objects that fit in one slab
+	void (*ctor)(void *);        // optional constructor, called once per object when its slab is created
+
+	struct slab *partial;        // slabs with some objects allocated
+	struct slab *full;           // slabs with every object allocated
+	struct slab *empty;          // slabs with no objects allocated
+
+	uint nslabs;                 // total number of slabs owned by this cache
+	uint nactive;                // number of objects currently allocated
+
+	struct kmem_cache *next;     // next cache in the list of every cache
+};
+
+struct kmem_cache *kmem_cache_create(const char *, size_t, void (*)(void *));
+void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+
+void slab_meminfo(struct meminfo *);
+
+void print_caches();
+
+#endif    // SLAB_H
@@ -0,0 +1,122 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: smp.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: multiprocessor support and per-cpu state
+ *
+ * Every cpu has a struct cpu with the process it is running, its idle process, and its own task
+ * state segment. Each cpu's task register selects its own tss descriptor in the gdt, so a cpu
+ * finds its struct cpu with a single str instruction, without having to ask its local apic.
+ */
+#ifndef SMP_H
+#define SMP_H
+
+#include <maestro.h>
+#include <intr.h>
+
+// most cpus maestro will run on, any more are left halted. must match NCPU in start.s
+#define NCPU       8
+
+// gdt selector of cpu 0's tss descriptor. cpu n's descriptor is n entries after it
+#define GDT_TSS    0x28
+
+// physical address the ap startup code in trampoline.s is copied to. it has to be page aligned and below 1M
+#define TRAMPOLINE 0x7000
+
+struct proc;
+
+// the cpu only reads esp0 and ss0, to find the kernel stack when an interrupt arrives in user mode
+struct tss
+{
+	u32 prev_tss;
+	u32 esp0;
+	u32 ss0;
+	u32 esp1;
+	u32 ss1;
+	u32 esp2;
+	u32 ss2;
+	u32 cr3;
+	u32 eip;
+	u32 eflags;
+	u32 eax;
+	u32 ecx;
+	u32 edx;
+	u32 ebx;
+	u32 esp;
+	u32 ebp;
+	u32 esi;
+	u32 edi;
+	u32 es;
+	u32 cs;
+	u32 ss;
+	u32 ds;
+	u32 fs;
+	u32 gs;
+	u32 ldt;
+	u16 trap;
+	u16 iomap;
+} __attribute__((packed));
+
+struct cpu
+{
+	int id;                   // index into cpus
+	u8 apic_id;               // id of the cpu's local apic
+	volatile bool started;    // set by the cpu itself once it is up and running its idle process
+	struct proc *proc;        // process the cpu is running
+	struct proc *idle;        // process the cpu runs when no other process is ready
+	volatile u32 softirqs;    // bitmap of softirqs raised on the cpu, see softirq.c
+	bool in_softirq;          // set while the cpu is running softirqs
+	struct proc *dead;        // process that exited and was switched away from, for the next one to free
+	struct proc *fpu_owner;   // process that last had the fpu, whose state the registers may still hold
+	struct tss tss;
+};
+
+extern struct cpu cpus[NCPU];
+extern int ncpu;
+
+/**
+ * @brief index of the cpu this is running on
+ */
+static inline int cpu_id()
+{
+	u16 tr;
+	asm volatile("str %0" : "=r"(tr));
+	return (tr - GDT_TSS) >> 3;
+}
+
+/**
+ * @brief state of the cpu this is running on
+ * the caller has to keep interrupts disabled for as long as it uses the result,
+ * or it could be preempted and carry on running on another cpu
+ */
+static inline struct cpu *this_cpu()
+{
+	return &cpus[cpu_id()];
+}
+
+/**
+ * @brief the process running on this cpu
+ * interrupts are held off between finding the cpu and reading its process,
+ * so the process can't be moved to another cpu in between
+ */
+static inline struct proc *current()
+{
+	int mask = disable();
+	struct proc *pptr = this_cpu()->proc;
+	restore(mask);
+	return pptr;
+}
+
+// the process making the call
+#define curr current()
+
+void smp_init();
+bool smp_others_idle();
+void lapic_eoi();
+void smp_resched(struct cpu *);
+void set_task(u32);
+
+#endif    // SMP_H
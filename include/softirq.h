@@ -0,0 +1,26 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: softirq.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: deferred interrupt work that can't block
+ */
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <maestro.h>
+
+// softirq vectors, in the order they run when several are raised at once
+enum
+{
+	SOFTIRQ_TIMER,    // wakes sleeping processes and expires timers after a clock tick
+	NR_SOFTIRQS,
+};
+
+void open_softirq(int, void (*)(void));
+void raise_softirq(int);
+void do_softirq();
+
+#endif    // SOFTIRQ_H
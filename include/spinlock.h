@@ -0,0 +1,119 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: spinlock.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: spinlocks for mutual exclusion between cpus
+ *
+ * Taking a lock also disables interrupts on the cpu taking it, and releasing it restores
+ * them, just like disable() and restore(). So an interrupt handler can never spin on a lock
+ * the code it interrupted holds. Locks are recursive, so code holding a lock may call
+ * functions that take it again, the same way disable() can be called with interrupts disabled.
+ */
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <maestro.h>
+#include <intr.h>
+#include <smp.h>
+
+struct spinlock
+{
+	volatile u32 locked;
+	volatile int cpu;    // id of the cpu holding the lock, or -1
+	uint depth;          // number of times the holding cpu has taken the lock
+	const char *name;
+};
+
+#define SPINLOCK_INIT(name) { 0, -1, 0, name }
+
+static inline void spin_init(struct spinlock *lk, const char *name)
+{
+	lk->locked = 0;
+	lk->cpu    = -1;
+	lk->depth  = 0;
+	lk->name   = name;
+}
+
+/**
+ * @brief takes a lock, spinning until it is free
+ * @param lk lock to take
+ * @return the interrupt state to pass to spin_unlock()
+ */
+static inline int spin_lock(struct spinlock *lk)
+{
+	int mask = disable();
+	int id   = cpu_id();
+
+	if (lk->cpu == id)
+	{
+		lk->depth++;
+		return mask;
+	}
+
+	// only try the atomic exchange once the lock looks free, so waiting
+	// cpus spin on their own cached copy instead of bouncing the line around
+	while (__sync_lock_test_and_set(&lk->locked, 1))
+	{
+		while (lk->locked)
+			asm volatile("pause");
+	}
+
+	lk->cpu   = id;
+	lk->depth = 1;
+	return mask;
+}
+
+/**
+ * @brief releases a lock, once it has been released as many times as it was taken
+ * @param lk lock to release
+ * @param mask interrupt state returned by the matching spin_lock()
+ */
+static inline void spin_unlock(struct spinlock *lk, int mask)
+{
+	if (--lk->depth == 0)
+	{
+		lk->cpu = -1;
+		__sync_lock_release(&lk->locked);
+	}
+
+	restore(mask);
+}
+
+/**
+ * @brief releases a lock however many times this cpu has taken it
+ * interrupts are left as they are
+ * @param lk lock to release
+ * @return depth the lock was held at, to pass to spin_relock(), or 0 if this cpu didn't hold it
+ */
+static inline uint spin_unlock_all(struct spinlock *lk)
+{
+	if (lk->cpu != cpu_id())
+		return 0;
+
+	uint depth = lk->depth;
+	lk->depth  = 0;
+	lk->cpu    = -1;
+	__sync_lock_release(&lk->locked);
+	return depth;
+}
+
+/**
+ * @brief takes back a lock released by spin_unlock_all(), at the depth it was held at
+ * interrupts are left as they are
+ * @param lk lock to take
+ * @param depth value returned by spin_unlock_all()
+ */
+static inline void spin_relock(struct spinlock *lk, uint depth)
+{
+	if (depth == 0)
+		return;
+
+	int mask  = spin_lock(lk);
+	lk->depth = depth;
+	restore(mask);
+}
+
+#endif    // SPINLOCK_H
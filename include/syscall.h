@@ -14,13 +14,26 @@
 #include <maestro.h>
 
 #include <intr.h>
+#include <spinlock.h>
 
 extern const int NUM_SYSCALLS;
 
+// held by a cpu for as long as it runs a system call, since the code behind them (the vfs,
+// ext2, the disk and tty drivers) was written for one cpu with interrupts disabled.
+// sched() lets go of it while a process is blocked in a system call, and takes it back after
+extern struct spinlock kernel_lock;
+
 #define isbadsysno(sysno) (sysno >= NUM_SYSCALLS)
 
 void sys_read(struct registers *);
 void sys_write(struct registers *);
+void sys_fork(struct registers *);
+void sys_brk(struct registers *);
+void sys_meminfo(struct registers *);
+void sys_nice(struct registers *);
+void sys_clock_gettime(struct registers *);
+void sys_nanosleep(struct registers *);
+void sys_sched_yield(struct registers *);
 
 extern void (*syscall_handlers[])(struct registers *);
 
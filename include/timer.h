@@ -0,0 +1,52 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: timer.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: kernel timers
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <maestro.h>
+
+#include <queue.h>
+
+// number of levels in the timing wheel
+#define TIMER_LEVELS     4
+
+// log2 of the number of slots in each level of the timing wheel
+#define TIMER_SLOT_BITS  6
+
+// number of slots in each level of the timing wheel
+#define TIMER_SLOTS      (1 << TIMER_SLOT_BITS)
+
+// longest delay in ms a timer can be set for, about 4.6 hours
+// timers set further out than this fire after TIMER_MAX_DELAY instead
+#define TIMER_MAX_DELAY  ((1u << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+/**
+ * @brief a function to be called once a delay has passed
+ * the timer's memory belongs to its owner, and must stay valid until it fires or is cancelled
+ */
+struct timer
+{
+	struct qnode link;           // link in the wheel slot or expired list the timer is in
+	struct queue *list;          // wheel slot or expired list the timer is in, or NULL if it isn't pending
+	u32 expires;                 // timestamp in ms the timer fires at
+	void (*func)(void *);        // called from the timer thread once the timer fires
+	void *arg;                   // passed to func
+};
+
+void timers_init();
+void timer_setup(struct timer *, void (*)(void *), void *);
+void timer_add(struct timer *, u32);
+bool timer_mod(struct timer *, u32);
+bool timer_cancel(struct timer *);
+bool timer_pending(struct timer *);
+void timer_tick(u32);
+u32 timer_next_expiry();
+
+#endif    // TIMER_H
@@ -27,10 +27,13 @@ struct file
 {
 	size_t size;           // size in bytes
 	size_t pos;            // seek offset
+	int refs;              // number of open file table entries pointing here, shared after a fork
 
 	struct vnode *n;    // reference to vfs node this open file represents
 };
 
+struct proc;
+
 void vfs_init();
 struct vnode *vfs_mkdir(char *);
 struct vnode *vfs_touch(char *);
@@ -39,5 +42,7 @@ int vfs_close(int);
 int vfs_seek(int, int);
 int vfs_read(int, void *, size_t);
 int vfs_write(int, void *, size_t);
+void vfs_fork(struct proc *, struct proc *);
+void vfs_exit(struct proc *);
 
 #endif    // VFS_H
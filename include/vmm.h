@@ -12,9 +12,21 @@
 
 #include <maestro.h>
 
+// virtual address where kernel space begins
+#define KERNEL_BASE            0xc0000000
+
+// lowest virtual address user memory may be mapped at, since the first 4M is shared with the kernel
+#define USER_BASE              0x400000
+
+// base of a window of kernel memory where vmm_kmap() temporarily maps physical pages
+#define KMAP_BASE              0xcfc00000
+
 // page size in bytes
 #define PAGE_SIZE              4096
 
+// size in bytes of a page mapped by a single page directory entry (pse)
+#define LARGE_PAGE_SIZE        0x400000
+
 // page table size in bytes
 #define PAGE_TABLE_SIZE        4096
 
@@ -24,6 +36,9 @@
 // number of entries in a page table/directory
 #define NUM_TABLE_ENTRIES      1024
 
+// kernel virtual address of a physical address in the direct map
+#define PHYS_TO_VIRT(addr)     ((void *) ((uintptr_t) (addr) + KERNEL_BASE))
+
 // physical address the bootloader placed the kernel page directory
 #define KPAGE_DIR_BASE         (u8 *) 0x8000
 
@@ -37,9 +52,48 @@
 #define PT_PRESENT 1
 #define PT_WRITABLE 2
 #define PT_USER 4
+#define PT_NOCACHE 0x10       // page is not cached, for memory mapped device registers
 #define PT_ACCESSED 0x20
 #define PT_DIRTY 0x40
-#define PT_FRAME 0x7ffff000
+#define PT_LARGE 0x80         // page directory entry maps a 4M page rather than a page table
+#define PT_GLOBAL 0x100
+#define PT_COW 0x200          // available to the os - page is shared copy on write
+#define PT_FRAME 0xfffff000
+
+// flags describing a region of a process's memory
+#define VM_READ      0x1
+#define VM_WRITE     0x2
+#define VM_GROWSDOWN 0x4    // region is a stack, and grows downwards when the page below it is touched
+
+// number of pages a tlb batch flushes one at a time, before it flushes the whole tlb instead
+#define TLB_BATCH_MAX 32
+
+/**
+ * @brief a set of pages whose stale translations have to be flushed from the tlb
+ * changes to many page table entries are collected into a batch, and flushed all at once
+ */
+struct tlb_batch
+{
+	uintptr_t addrs[TLB_BATCH_MAX];
+	uint count;                  // number of pages added, which may be more than fit in addrs
+	bool kernel;                 // set if any page is a (global) kernel page
+};
+
+struct proc;
+struct meminfo;
+
+/**
+ * @brief a range of a process's user memory
+ * pages in a region are not backed by physical memory until they are first touched,
+ * at which point the page fault handler maps a zeroed frame in
+ */
+struct vm_region
+{
+	uintptr_t start;             // page aligned address of the first byte of the region
+	uintptr_t end;               // page aligned address one past the last byte of the region
+	unsigned flags;
+	struct vm_region *next;      // next region of the process, in address order
+};
 
 // page directory entry
 struct pde
@@ -72,7 +126,24 @@ struct pte
 void vmm_init();
 
 uintptr_t vmm_create_address_space();
-void vmm_map_page(uintptr_t, uintptr_t, unsigned);
+uintptr_t vmm_kernel_address_space();
+int vmm_map_page(uintptr_t, uintptr_t, unsigned);
+void vmm_map_large_page(uintptr_t, uintptr_t, unsigned);
+uintptr_t vmm_unmap_page(uintptr_t);
+void vmm_unmap_range(uintptr_t, uintptr_t);
+void tlb_batch_init(struct tlb_batch *);
+void tlb_batch_add(struct tlb_batch *, uintptr_t);
+void tlb_batch_flush(struct tlb_batch *);
+void *vmm_kmap(uintptr_t);
+void vmm_kunmap(void *);
 
+struct vm_region *vmm_add_region(struct proc *, uintptr_t, uintptr_t, unsigned);
+struct vm_region *vmm_find_region(struct proc *, uintptr_t);
+void vmm_protect_region(struct vm_region *);
+uintptr_t vmm_brk(struct proc *, uintptr_t);
+int vmm_clone_address_space(struct proc *, struct proc *);
+void vmm_destroy_address_space(struct proc *);
+void vmm_meminfo(struct meminfo *);
+uint vmm_resident_pages(struct proc *);
 
 #endif // VMM_H
@@ -0,0 +1,33 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: workqueue.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: deferred work that runs in process context
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <maestro.h>
+
+#include <queue.h>
+
+/**
+ * @brief a function to be called later by the worker thread
+ * the work's memory belongs to its owner, and must stay valid until it has run
+ */
+struct work
+{
+	struct qnode link;           // link in the work queue
+	bool pending;                // whether the work is queued and hasn't started running yet
+	void (*func)(void *);        // called from the worker thread
+	void *arg;                   // passed to func
+};
+
+void workqueue_init();
+void work_init(struct work *, void (*)(void *), void *);
+bool queue_work(struct work *);
+
+#endif    // WORKQUEUE_H
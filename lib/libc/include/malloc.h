@@ -16,11 +16,21 @@
 #include <stddef.h>
 
 // size in bytes of chunks requested from OS
-#define ARENA_SIZE 4096
+// the kernel only maps heap pages once they are touched, so asking for a lot at once is cheap
+#define ARENA_SIZE (128 * 1024)
 
 // number of freelists
 #define N_LISTS 59
 
+// number of fast bins, one for each block size from 16 up to FASTBIN_MAX_SIZE bytes
+#define N_FASTBINS 32
+
+// largest block size in bytes kept in a fast bin
+#define FASTBIN_MAX_SIZE ((N_FASTBINS + 1) * 8)
+
+// most blocks a single fast bin holds before freed blocks go back to the freelists
+#define FASTBIN_DEPTH 64
+
 // size of the header for an allocated block
 #define ALLOC_HEADER_SIZE (sizeof(header) - (2 * sizeof(header *)))
 
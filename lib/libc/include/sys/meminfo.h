@@ -0,0 +1,48 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: libc/sys/meminfo.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: kernel memory usage counters
+ *
+ * This layout mirrors the kernel's meminfo.h, so the two have to be changed together.
+ */
+
+#ifndef SYS_MEMINFO_H
+#define SYS_MEMINFO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// number of size classes kmalloc usage is broken down into
+// class 0 holds blocks of up to KMALLOC_CLASS_MIN bytes, and each class after it
+// holds blocks up to twice as large as the one before. the final class holds everything larger
+#define KMALLOC_NCLASSES  8
+
+// largest block size in bytes counted in kmalloc size class 0
+#define KMALLOC_CLASS_MIN 32
+
+struct meminfo
+{
+	uint32_t total_frames;                       // frames of physical memory the kernel manages
+	uint32_t free_frames;                        // frames that can be allocated
+	uint32_t used_frames;                        // frames currently allocated
+	uint32_t zeroed_frames;                      // free frames that are already zeroed
+	uint32_t page_table_pages;                   // frames holding page directories and page tables
+
+	uint32_t kheap_size;                         // size in bytes of the kernel heap arena
+	uint32_t kmalloc_bytes[KMALLOC_NCLASSES];    // bytes allocated from the kernel heap, by size class
+	uint32_t kmalloc_count[KMALLOC_NCLASSES];    // blocks allocated from the kernel heap, by size class
+
+	uint32_t slab_caches;                        // number of slab caches
+	uint32_t slab_pages;                         // pages owned by every slab cache
+	uint32_t slab_bytes;                         // bytes of objects allocated from slab caches
+
+	uint32_t resident_pages;                     // user pages mapped in by the process that was asked about
+};
+
+int meminfo(struct meminfo *, pid_t);
+
+#endif    // SYS_MEMINFO_H
@@ -0,0 +1,28 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: libc/sys/resource.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: process scheduling priorities
+ *
+ * A priority is a level of the kernel's multi-level feedback queue, from PRIO_MIN (the highest)
+ * to PRIO_MAX (the lowest). Pid 0 is a real process in maestro, so unlike POSIX, a who of -1
+ * refers to the calling process.
+ */
+
+#ifndef SYS_RESOURCE_H
+#define SYS_RESOURCE_H
+
+#include <sys/types.h>
+
+#define PRIO_PROCESS 0
+
+#define PRIO_MIN     0
+#define PRIO_MAX     7
+
+int getpriority(int, pid_t);
+int setpriority(int, pid_t, int);
+
+#endif    // SYS_RESOURCE_H
@@ -2,5 +2,7 @@
 #define TYPES_H
 
 typedef int pid_t;
+typedef int time_t;
+typedef int clockid_t;
 
 #endif    // TYPES_H
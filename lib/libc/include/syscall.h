@@ -13,10 +13,17 @@
 
 #include <stdint.h>
 
-#define SYS_READ  0
-#define SYS_WRITE 1
-#define SYS_EXIT  2
-#define SYS_OPEN  3
+#define SYS_READ          0
+#define SYS_WRITE         1
+#define SYS_EXIT          2
+#define SYS_OPEN          3
+#define SYS_FORK          4
+#define SYS_BRK           5
+#define SYS_MEMINFO       6
+#define SYS_NICE          7
+#define SYS_CLOCK_GETTIME 8
+#define SYS_NANOSLEEP     9
+#define SYS_SCHED_YIELD   10
 
 int syscall(int, ...);
 
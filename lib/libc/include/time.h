@@ -1,4 +1,19 @@
 #ifndef TIME_H
 #define TIME_H
 
+#include <sys/types.h>
+
+// the kernel has no real time clock yet, so CLOCK_REALTIME counts from boot just like CLOCK_MONOTONIC
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec
+{
+	time_t tv_sec;
+	long tv_nsec;
+};
+
+int clock_gettime(clockid_t, struct timespec *);
+int nanosleep(const struct timespec *, struct timespec *);
+
 #endif    // TIME_H
@@ -23,6 +23,8 @@ int execv(const char*, char* const[]);
 int execve(const char*, char* const[], char* const[]);
 int execvp(const char*, char* const[]);
 pid_t fork(void);
+int brk(void *);
 void *sbrk(intptr_t);
+int nice(int);
 
 #endif    // UNISTD_H
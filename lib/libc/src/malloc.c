@@ -7,12 +7,20 @@
  * DATE: April 27th, 2022
  * DESCRIPTION: userspace malloc modified from Doug Lea's malloc:
  * 	http://gee.cs.oswego.edu/dl/html/malloc.html
+ *
+ * Freed small blocks first go to a per-size LIFO fast bin. Blocks in a fast bin stay
+ * marked allocated, so nothing coalesces with them, and malloc()/free() of a recently
+ * used size is just a pop or push. Blocks that don't fit in a fast bin go back to the
+ * freelists, where they are coalesced with their neighbors. Small freelists hold blocks
+ * of exactly one size, and a bitmap records which of them are non-empty. Large free
+ * blocks are kept in a tree ordered by size, so the best fit is found without a scan.
  */
 
 #include <malloc.h>
 
 #include <stddef.h>
 #include <string.h>
+#include <unistd.h>
 
 // rounds an number x up to the nearest multiple of 8
 #define round8(x) ((x + 7) & ~0x7);
@@ -23,6 +31,17 @@ header freelistSentinels[N_LISTS];
 header *lastFencePost;
 void *base;
 
+// set bit n denotes small freelist n is not empty
+static uint32_t freelist_map[(N_LISTS + 31) / 32];
+
+// fast bin n holds free blocks of size (n + 2) * 8, linked through their next pointers
+static header *fastbins[N_FASTBINS];
+static unsigned fastbin_count[N_FASTBINS];
+
+// root of the tree of large free blocks
+// a block in the tree reuses its next and prev pointers as its left and right children
+static header *tree_root;
+
 static inline unsigned int get_freelist_index(size_t allocation_size);
 static inline unsigned int get_freelist_index_from_header(header *h);
 static inline header *get_allocable_block(size_t request_size);
@@ -30,6 +49,11 @@ static inline bool is_freelist_empty(unsigned int idx);
 static inline void remove_from_freelist(header *h);
 static inline void insert_into_freelist(header *h);
 
+// Helper functions for the tree of large free blocks
+static header *tree_insert(header *root, header *h);
+static header *tree_remove(header *root, header *h);
+static header *tree_find(size_t size);
+
 // Helper functions for manipulating pointers to headers
 static inline header *get_header_from_offset(void *ptr, ptrdiff_t off);
 static inline header *get_left_header(header *h);
@@ -139,6 +163,8 @@ inline static void insert_fenceposts(void *raw_mem, size_t size)
 static header *allocate_chunk(size_t size)
 {
 	void *mem = sbrk(size);
+	if (mem == (void *) -1)
+		return NULL;
 
 	insert_fenceposts(mem, size);
 	header *hdr = (header *) ((char *) mem + ALLOC_HEADER_SIZE);
@@ -148,63 +174,206 @@ static header *allocate_chunk(size_t size)
 	return hdr;
 }
 
+/**
+ * @brief finds a free block large enough for a request
+ * @param request_size size in bytes of the block needed, including its header
+ * @return a free block of at least request_size bytes, or NULL if there is none
+ */
 static inline header *get_allocable_block(size_t request_size)
 {
-	size_t allocable_size = request_size - ALLOC_HEADER_SIZE;
-	int index = get_freelist_index(allocable_size);
-	while (is_freelist_empty(index) && index < N_LISTS - 1)
-		index++;
-	
-	if (index != N_LISTS - 1)
-		return freelistSentinels[index].next;
-	
-	header *sentinal = &freelistSentinels[N_LISTS - 1];
-	header *block = sentinal->next;
-	while (block != sentinal)
+	unsigned int index = get_freelist_index(request_size - ALLOC_HEADER_SIZE);
+
+	// small freelists hold blocks of exactly one size, so the
+	// first non-empty one at or above index has a block that fits
+	for (unsigned int word = index / 32; index < N_LISTS - 1 && word < (N_LISTS + 31) / 32; word++)
 	{
-		//printf("hi\n");
-		if (get_block_state(block) == UNALLOCATED && get_block_size(block) >= request_size)
-			return block;
-		block = block->next;
+		uint32_t bits = freelist_map[word];
+		if (word == index / 32)
+			bits &= ~0u << (index % 32);
+
+		if (bits)
+			return freelistSentinels[word * 32 + __builtin_ctz(bits)].next;
 	}
 
-	return NULL;
+	return tree_find(request_size);
 }
 
 static inline bool is_freelist_empty(unsigned int idx)
 {
-	//assert(idx > 0 && idx < N_LISTS);
 	header *sentinal = &freelistSentinels[idx];
 	return sentinal == sentinal->next;
 }
 
+/**
+ * @brief Removes a free block from its freelist, or the tree if it is large
+ * must be called before the block's size changes, since the size decides where it is
+ * @param h block to remove
+ */
 static inline void remove_from_freelist(header *h)
 {
+	unsigned int index = get_freelist_index_from_header(h);
+	if (index == N_LISTS - 1)
+	{
+		tree_root = tree_remove(tree_root, h);
+		return;
+	}
+
 	h->next->prev = h->prev;
-    h->prev->next = h->next;
+	h->prev->next = h->next;
+
+	if (is_freelist_empty(index))
+		freelist_map[index / 32] &= ~(1u << (index % 32));
 }
 
+/**
+ * @brief Inserts a free block into the freelist for its size, or the tree if it is large
+ * @param h block to insert
+ */
 static inline void insert_into_freelist(header *h)
 {
-	//assert(get_block_state(h) == UNALLOCATED);
+	unsigned int index = get_freelist_index_from_header(h);
+	if (index == N_LISTS - 1)
+	{
+		tree_root = tree_insert(tree_root, h);
+		return;
+	}
 
-	int index = get_freelist_index_from_header(h);
-	header *sentinal = &freelistSentinels[index];
-	if (is_freelist_empty(index))
+	header *sentinal     = &freelistSentinels[index];
+	h->next              = sentinal->next;
+	h->prev              = sentinal;
+	sentinal->next->prev = h;
+	sentinal->next       = h;
+
+	freelist_map[index / 32] |= 1u << (index % 32);
+}
+
+/*
+ * The tree of large free blocks is a treap: a binary search tree ordered by
+ * (size, address), which is also a heap on a pseudo-random priority derived from
+ * each block's address. The random priorities keep it balanced in expectation,
+ * even when blocks are freed in sorted order.
+ */
+
+static inline unsigned int tree_priority(header *h)
+{
+	return ((uintptr_t) h >> 3) * 2654435761u;
+}
+
+static inline bool tree_less(header *a, header *b)
+{
+	return get_block_size(a) < get_block_size(b) || (get_block_size(a) == get_block_size(b) && a < b);
+}
+
+static inline header *rotate_right(header *root)
+{
+	header *left = root->next;
+	root->next   = left->prev;
+	left->prev   = root;
+	return left;
+}
+
+static inline header *rotate_left(header *root)
+{
+	header *right = root->prev;
+	root->prev    = right->next;
+	right->next   = root;
+	return right;
+}
+
+/**
+ * @brief inserts a block into a subtree
+ * @return the new root of the subtree
+ */
+static header *tree_insert(header *root, header *h)
+{
+	if (!root)
 	{
-		sentinal->prev = h;
-		sentinal->next = h;
-		h->prev = sentinal;
-		h->next = sentinal;
-    }
-	
+		h->next = NULL;
+		h->prev = NULL;
+		return h;
+	}
+
+	if (tree_less(h, root))
+	{
+		root->next = tree_insert(root->next, h);
+		if (tree_priority(root->next) > tree_priority(root))
+			root = rotate_right(root);
+	}
+
+	else
+	{
+		root->prev = tree_insert(root->prev, h);
+		if (tree_priority(root->prev) > tree_priority(root))
+			root = rotate_left(root);
+	}
+
+	return root;
+}
+
+/**
+ * @brief joins two subtrees, where every block in left is less than every block in right
+ * @return the root of the joined tree
+ */
+static header *tree_merge(header *left, header *right)
+{
+	if (!left)
+		return right;
+
+	if (!right)
+		return left;
+
+	if (tree_priority(left) > tree_priority(right))
+	{
+		left->prev = tree_merge(left->prev, right);
+		return left;
+	}
+
+	right->next = tree_merge(left, right->next);
+	return right;
+}
+
+/**
+ * @brief removes a block from a subtree
+ * @return the new root of the subtree
+ */
+static header *tree_remove(header *root, header *h)
+{
+	if (!root)
+		return NULL;
+
+	if (root == h)
+		return tree_merge(h->next, h->prev);
+
+	if (tree_less(h, root))
+		root->next = tree_remove(root->next, h);
 	else
+		root->prev = tree_remove(root->prev, h);
+
+	return root;
+}
+
+/**
+ * @brief finds the smallest large free block that is at least size bytes
+ * @return the best fitting block, or NULL if none are large enough
+ */
+static header *tree_find(size_t size)
+{
+	header *best = NULL;
+	header *node = tree_root;
+
+	while (node)
 	{
-		h->next = sentinal->next;
-		sentinal->next->prev = h;
-		sentinal->next = h;
-		h->prev = sentinal;
-    }
+		if (get_block_size(node) >= size)
+		{
+			best = node;
+			node = node->next;
+		}
+
+		else
+			node = node->prev;
+	}
+
+	return best;
 }
 
 /**
@@ -220,30 +389,49 @@ static inline header *allocate_object(size_t size)
 	size_t request_size = round8(size + ALLOC_HEADER_SIZE);
 	if (request_size < sizeof(header))
 		request_size = sizeof(header);
-	
+
+	// fast path - reuse the most recently freed block of this size as is
+	if (request_size <= FASTBIN_MAX_SIZE)
+	{
+		unsigned int bin = request_size / 8 - 2;
+		header *block    = fastbins[bin];
+		if (block)
+		{
+			fastbins[bin] = block->next;
+			fastbin_count[bin]--;
+			return (header *) block->data;
+		}
+	}
+
 	header *block = get_allocable_block(request_size);
 	if (!block)
 	{
-		header *chunk = allocate_chunk(ARENA_SIZE);
+		// a request larger than an arena gets a chunk of its own size
+		size_t chunk_size = ARENA_SIZE;
+		if (request_size + 2 * ALLOC_HEADER_SIZE > chunk_size)
+			chunk_size = (request_size + 2 * ALLOC_HEADER_SIZE + ARENA_SIZE - 1) & ~(ARENA_SIZE - 1);
+
+		header *chunk = allocate_chunk(chunk_size);
+		if (!chunk)
+			return NULL;
+
 		header *first_fencepost = get_left_header(chunk);
 		header *last_fencepost = get_right_header(chunk);
 		header *last_allocable_block = get_left_header(lastFencePost);
-		int old_fl_idx = get_freelist_index_from_header(last_allocable_block);
+
+		// the new chunk picks up right where the last one left off, so
+		// drop the fenceposts between them and merge it with the last block
 		if (get_right_header(lastFencePost) == first_fencepost)
 		{
 			if (get_block_state(last_allocable_block) == UNALLOCATED)
 			{
-				int old_fl_index = get_freelist_index_from_header(last_allocable_block);
+				remove_from_freelist(last_allocable_block);
 				set_block_size(last_allocable_block, get_block_size(last_allocable_block) + 2 * ALLOC_HEADER_SIZE + get_block_size(chunk));
 				last_fencepost->left_size = get_block_size(last_allocable_block);
-				if (old_fl_idx != N_LISTS - 1 && (old_fl_idx != get_freelist_index_from_header(last_allocable_block)))
-				{
-					remove_from_freelist(last_allocable_block);
-					insert_into_freelist(last_allocable_block);
-				}
+				insert_into_freelist(last_allocable_block);
 			}
 
-			else if (get_block_state(last_allocable_block) == ALLOCATED)
+			else
 			{
 				set_block_size_and_state(lastFencePost, get_block_size(chunk) + 2 * ALLOC_HEADER_SIZE, UNALLOCATED);
 				lastFencePost->left_size = get_block_size(last_allocable_block);
@@ -261,35 +449,29 @@ static inline header *allocate_object(size_t size)
 		return allocate_object(size);
 	}
 
+	remove_from_freelist(block);
+
 	// determine if block can be split into 2 allocable blocks
 	size_t block_size = get_block_size(block);
 	size_t rem = block_size - request_size;
 
-	// block can be split
+	// block can be split - the left part stays free, and the right part is handed out
 	if (rem >= sizeof(header))
 	{
 		header *left = block;
-		size_t left_size = block_size - request_size;
-		set_block_size(left, left_size);
+		set_block_size(left, rem);
+		insert_into_freelist(left);
 
-		header *right = get_header_from_offset(left, left_size);
-		set_block_size(right, request_size);
-		right->left_size = left_size;
+		header *right = get_header_from_offset(left, rem);
+		set_block_size_and_state(right, request_size, ALLOCATED);
+		right->left_size = rem;
 		get_right_header(right)->left_size = request_size;
 
-		if (get_freelist_index(block_size) != get_freelist_index(left_size))
-		{
-			remove_from_freelist(left);
-			insert_into_freelist(left);
-		}
-
-		set_block_state(right, ALLOCATED);
 		return (header *) right->data;
 	}
 
-	remove_from_freelist(block);
 	set_block_state(block, ALLOCATED);
-	return (header *) block->data;	
+	return (header *) block->data;
 }
 
 /**
@@ -310,81 +492,36 @@ static inline void deallocate_object(void *p)
 {
 	if (!p)
 		return;
-	
+
 	// header corresponding to the freeing address
-	struct header *h = (struct header *) (p - ALLOC_HEADER_SIZE);
+	header *h = ptr_to_header(p);
 
 	// check for double free
 	if (get_block_state(h) != ALLOCATED)
-	{
-		//printf("Double Free Detected\n");
-		//assert(false);
-	}
+		return;
 
 	// get left and right headers to check their allocation status
-	struct header *left = get_left_header(h);
-	struct header *right = get_right_header(h);
+	header *left  = get_left_header(h);
+	header *right = get_right_header(h);
 	set_block_state(h, UNALLOCATED);
 
-	// case 1 - neither the right nor the left blocks are unallocated
-	if (get_block_state(left) != UNALLOCATED && get_block_state(right) != UNALLOCATED)
-	{
-		insert_into_freelist(h);
-	}
-
-	// case 2 - Only the right block is unallocated
-	// coalece right block and h together
-	else if (get_block_state(left) != UNALLOCATED && get_block_state(right) == UNALLOCATED)
+	// coalesce with whichever neighbors are free.
+	// they have to leave their freelists first, since their size is about to change
+	if (get_block_state(right) == UNALLOCATED)
 	{
-		int old_fl_index = get_freelist_index_from_header(right);
+		remove_from_freelist(right);
 		set_block_size(h, get_block_size(h) + get_block_size(right));
-		if (old_fl_index != get_freelist_index_from_header(h))
-		{
-			remove_from_freelist(right);
-			insert_into_freelist(h);
-		}
-
-		else
-		{
-			right->next->prev = h;
-			right->prev->next = h;
-		}
-
-		get_right_header(h)->left_size = get_block_size(h);
 	}
 
-	// case 3 - Only the left block is unallocated
-	// coalece left block and h together
-	else if (get_block_state(left) == UNALLOCATED && get_block_state(right) != UNALLOCATED)
+	if (get_block_state(left) == UNALLOCATED)
 	{
-		int old_fl_index = get_freelist_index_from_header(left);
+		remove_from_freelist(left);
 		set_block_size(left, get_block_size(left) + get_block_size(h));
-		if (old_fl_index != get_freelist_index_from_header(left))
-		{
-			remove_from_freelist(left);
-			insert_into_freelist(left);
-		}
-
-		get_right_header(left)->left_size = get_block_size(left);
+		h = left;
 	}
 
-	// case 4 - both left and right blocks are unallocated
-	// coalesce left, h, and right together
-	else if (get_block_state(left) == UNALLOCATED && get_block_state(right) == UNALLOCATED)
-	{
-		int old_fl_index = get_freelist_index_from_header(left);
-		set_block_size(left, get_block_size(left) + get_block_size(h) + get_block_size(right));
-		if (old_fl_index != get_freelist_index_from_header(left))
-		{
-			//printf("bing bong\n");
-			remove_from_freelist(left);
-			insert_into_freelist(left);
-		}
-
-		right->prev->next = right->next;
-		right->next->prev = left;
-		get_right_header(left)->left_size = get_block_size(left);
-	}
+	get_right_header(h)->left_size = get_block_size(h);
+	insert_into_freelist(h);
 }
 
 /**
@@ -395,6 +532,8 @@ static void init()
 {
 	// Allocate the first chunk from the OS
 	header *block         = allocate_chunk(ARENA_SIZE);
+	if (!block)
+		return;
 
 	header *prevFencePost = get_header_from_offset(block, -ALLOC_HEADER_SIZE);
 
@@ -413,11 +552,7 @@ static void init()
 	}
 
 	// Insert first chunk into the free list
-	header *freelist = &freelistSentinels[N_LISTS - 1];
-	freelist->next   = block;
-	freelist->prev   = block;
-	block->next      = freelist;
-	block->prev      = freelist;
+	insert_into_freelist(block);
 }
 
 /*
@@ -428,7 +563,9 @@ void *malloc(size_t size)
 	if (!initialized)
 	{
 		init();
-		initialized = true;
+		initialized = base != NULL;
+		if (!initialized)
+			return NULL;
 	}
 
 	header *hdr = allocate_object(size);
@@ -450,5 +587,32 @@ void *realloc(void *ptr, size_t size)
 
 void free(void *p)
 {
+	if (!p)
+		return;
+
+	header *h = ptr_to_header(p);
+	if (get_block_state(h) != ALLOCATED)
+		return;
+
+	// fast path - keep a small block as is for the next request of its size
+	size_t size = get_block_size(h);
+	if (size <= FASTBIN_MAX_SIZE)
+	{
+		unsigned int bin = size / 8 - 2;
+
+		// check for double free - a block in a fast bin is still marked allocated,
+		// so freeing the block just pushed would otherwise link it to itself
+		if (fastbins[bin] == h)
+			return;
+
+		if (fastbin_count[bin] < FASTBIN_DEPTH)
+		{
+			h->next       = fastbins[bin];
+			fastbins[bin] = h;
+			fastbin_count[bin]++;
+			return;
+		}
+	}
+
 	deallocate_object(p);
 }
\ No newline at end of file
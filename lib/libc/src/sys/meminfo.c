@@ -0,0 +1,13 @@
+#include <sys/meminfo.h>
+#include <syscall.h>
+
+/**
+ * @brief reads the kernel's memory usage counters
+ * @param info filled in with the counters
+ * @param pid process whose resident pages to count, or -1 for the calling process
+ * @return 0 on success, or -1 on failure
+ */
+int meminfo(struct meminfo *info, pid_t pid)
+{
+	return syscall(SYS_MEMINFO, info, pid);
+}
@@ -0,0 +1,19 @@
+#include <sys/resource.h>
+#include <syscall.h>
+
+int getpriority(int which, pid_t who)
+{
+	if (which != PRIO_PROCESS)
+		return -1;
+
+	return syscall(SYS_NICE, who, 0);
+}
+
+int setpriority(int which, pid_t who, int prio)
+{
+	int curr = getpriority(which, who);
+	if (curr < 0)
+		return -1;
+
+	return syscall(SYS_NICE, who, prio - curr) == prio ? 0 : -1;
+}
@@ -32,12 +32,30 @@ int syscall(int sysno, ...)
 
 	switch (sysno)
 	{
+		// syscalls with no arguments
+		case SYS_FORK:
+		case SYS_SCHED_YIELD:
+			ret = syscall0(sysno);
+			break;
+
         // syscalls with 1 argument
         case SYS_EXIT:
+		case SYS_BRK:
             arg1 = va_arg(args, uint32_t);
             ret = syscall1(sysno, arg1);
 			break;
 
+		// syscalls with 2 arguments
+		case SYS_MEMINFO:
+		case SYS_NICE:
+		case SYS_CLOCK_GETTIME:
+		case SYS_NANOSLEEP:
+			arg1 = va_arg(args, uint32_t);
+			arg2 = va_arg(args, uint32_t);
+
+			ret = syscall2(sysno, arg1, arg2);
+			break;
+
 		// syscalls with 3 arguments
 		case SYS_READ:
 		case SYS_WRITE:
@@ -0,0 +1,7 @@
+#include <time.h>
+#include <syscall.h>
+
+int clock_gettime(clockid_t clockid, struct timespec *tp)
+{
+	return syscall(SYS_CLOCK_GETTIME, clockid, tp);
+}
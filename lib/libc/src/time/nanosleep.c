@@ -0,0 +1,7 @@
+#include <time.h>
+#include <syscall.h>
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	return syscall(SYS_NANOSLEEP, req, rem);
+}
@@ -0,0 +1,7 @@
+#include <unistd.h>
+#include <syscall.h>
+
+pid_t fork(void)
+{
+	return syscall(SYS_FORK);
+}
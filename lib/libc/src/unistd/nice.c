@@ -0,0 +1,7 @@
+#include <unistd.h>
+#include <syscall.h>
+
+int nice(int inc)
+{
+	return syscall(SYS_NICE, -1, inc);
+}
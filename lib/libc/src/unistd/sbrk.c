@@ -1,7 +1,26 @@
 #include <unistd.h>
+#include <syscall.h>
+
+// current program break, fetched from the kernel on first use
+static char *curbrk = NULL;
+
+int brk(void *addr)
+{
+	curbrk = (char *) syscall(SYS_BRK, addr);
+	return curbrk == addr ? 0 : -1;
+}
 
 void *sbrk(intptr_t increment)
 {
-    (void) increment;
-	return NULL;
+	if (!curbrk)
+		curbrk = (char *) syscall(SYS_BRK, 0);
+
+	char *old = curbrk;
+	if (increment == 0)
+		return old;
+
+	if (brk(old + increment) != 0)
+		return (void *) -1;
+
+	return old;
 }
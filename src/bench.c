@@ -0,0 +1,273 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: bench.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: in-kernel microbenchmarks, built with `make BENCH=1`
+ *
+ * Results are printed to the serial console in cpu cycles as measured by rdtsc,
+ * except for the scheduler benchmark, which times whole processes in ms.
+ */
+#include <bench.h>
+
+#include <bitmap.h>
+#include <kmalloc.h>
+#include <kprintf.h>
+#include <pmm.h>
+#include <proc.h>
+#include <smp.h>
+#include <vmm.h>
+
+// number of blocks in 4G of memory
+#define BLOCKS_4G (1024 * 1024)
+
+// number of allocations timed in each run
+#define BENCH_ALLOCS 4096
+
+// bytes of physical memory walked by the tlb benchmark
+#define BENCH_WALK (8 * 1024 * 1024)
+
+// number of times the tlb benchmark walks its memory
+#define BENCH_PASSES 16
+
+// unused kernel virtual address where the tlb benchmark maps memory with 4K pages
+#define BENCH_WINDOW 0xf0000000
+
+// most cpu bound processes the scheduler benchmark runs at once
+#define BENCH_PROCS (2 * NCPU)
+
+// defined in vmm.c
+extern u32 *PAGE_DIR;
+
+/**
+ * @brief times the search for a free block in a 4G map where every block
+ * before a given point is used, and only every other block after it is free
+ *
+ * the flat bitmap is searched from word 0 the way pmm_alloc() used to,
+ * the hierarchical bitmap is searched the way the buddy allocator does now
+ *
+ * @param flat flat bitmap where a set bit denotes a used block
+ * @param hb hierarchical bitmap where a set bit denotes a free block
+ * @param first first block that may be free
+ */
+static void bench_fragmented(u32 *flat, struct hbitmap *hb, u32 first)
+{
+	hbitmap_init(hb, hb->l0, BLOCKS_4G);
+	memset(flat, 0xff, BLOCKS_4G / 8);
+
+	for (u32 i = 0; i < 2 * BENCH_ALLOCS; i += 2)
+	{
+		BITMAP_CLEAR(flat, first + i);
+		hbitmap_set(hb, first + i);
+	}
+
+	u64 t0 = rdtsc();
+	for (int i = 0; i < BENCH_ALLOCS; i++)
+	{
+		int block = BITMAP_FIRST_CLEAR(flat, BLOCKS_4G);
+		BITMAP_SET(flat, block);
+	}
+
+	u64 t1 = rdtsc();
+	for (int i = 0; i < BENCH_ALLOCS; i++)
+	{
+		int block = hbitmap_find(hb);
+		hbitmap_clear(hb, block);
+		hb->hint = block + 1;
+	}
+
+	u64 t2 = rdtsc();
+
+	kprintf("first free block %d: linear %d cycles/alloc, hierarchical %d cycles/alloc\n",
+	        first,
+	        (u32) ((t1 - t0) / BENCH_ALLOCS),
+	        (u32) ((t2 - t1) / BENCH_ALLOCS));
+}
+
+/**
+ * @brief compares free block search in a fully fragmented 4G map
+ * using a flat bitmap and a hierarchical bitmap, then times the real pmm
+ */
+static void bench_pmm()
+{
+	kprintf("\tPMM BENCHMARK\n");
+
+	u32 *flat = kmalloc(BLOCKS_4G / 8);
+	struct hbitmap hb;
+	hb.l0 = kmalloc(hbitmap_size(BLOCKS_4G));
+
+	if (!flat || !hb.l0)
+	{
+		kprintf("bench_pmm: not enough heap!\n");
+		kfree(flat);
+		kfree(hb.l0);
+		return;
+	}
+
+	// the further into memory the free blocks are, the longer a linear search takes,
+	// while the hierarchical search should stay flat
+	bench_fragmented(flat, &hb, 0);
+	bench_fragmented(flat, &hb, BLOCKS_4G / 4);
+	bench_fragmented(flat, &hb, BLOCKS_4G / 2);
+	bench_fragmented(flat, &hb, BLOCKS_4G - 2 * BENCH_ALLOCS);
+
+	kfree(flat);
+	kfree(hb.l0);
+
+	// and the real allocator, alloc then free in a loop
+	static uintptr_t blocks[BENCH_ALLOCS / 16];
+	const int n = BENCH_ALLOCS / 16;
+
+	u64 t0 = rdtsc();
+	for (int i = 0; i < n; i++)
+		blocks[i] = pmm_alloc();
+
+	u64 t1 = rdtsc();
+	for (int i = 0; i < n; i++)
+		pmm_free(blocks[i]);
+
+	u64 t2 = rdtsc();
+
+	kprintf("pmm_alloc: %d cycles, pmm_free: %d cycles\n", (u32) ((t1 - t0) / n), (u32) ((t2 - t1) / n));
+}
+
+/**
+ * @brief reads one byte from every page of a range of memory, a few times over
+ * the stride is a page plus a cache line, so consecutive reads don't compete for the same cache set
+ * @param p start of the range
+ * @param len length of the range in bytes
+ * @return cycles per read
+ */
+static u32 bench_walk(volatile u8 *p, u32 len)
+{
+	u32 sum = 0;
+	u32 reads = 0;
+
+	u64 t0 = rdtsc();
+	for (int pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		for (u32 off = (pass * 64) % PAGE_SIZE; off < len; off += PAGE_SIZE + 64)
+		{
+			sum += p[off];
+			reads++;
+		}
+	}
+
+	u64 t1 = rdtsc();
+	(void) sum;
+	return (u32) ((t1 - t0) / reads);
+}
+
+/**
+ * @brief reports the page table memory the kernel's mappings use, then times walking
+ * the same physical memory through the direct map and through 4K pages
+ */
+static void bench_vmm()
+{
+	kprintf("\tVMM BENCHMARK\n");
+
+	// count what kernel space costs now, and what it would cost mapped with 4K pages
+	int tables = 0, large = 0;
+	for (int i = KERNEL_BASE >> 22; i < NUM_TABLE_ENTRIES - 1; i++)
+	{
+		if (!(PAGE_DIR[i] & PT_PRESENT))
+			continue;
+
+		if (PAGE_DIR[i] & PT_LARGE)
+			large++;
+		else
+			tables++;
+	}
+
+	kprintf("kernel page tables: %dK with 4M pages, %dK with only 4K pages\n",
+	        tables * PAGE_TABLE_SIZE / 1024,
+	        (tables + large) * PAGE_TABLE_SIZE / 1024);
+
+	// walk memory past the first 4M, so the walk doesn't include the kernel image
+	u32 len = BENCH_WALK;
+	if (pmm_mem_end() < LARGE_PAGE_SIZE + len)
+		len = pmm_mem_end() - LARGE_PAGE_SIZE;
+
+	for (u32 off = 0; off < len; off += PAGE_SIZE)
+		vmm_map_page(LARGE_PAGE_SIZE + off, BENCH_WINDOW + off, PT_PRESENT | PT_WRITABLE);
+
+	// warm up the caches so both walks only differ in how they are mapped
+	bench_walk(PHYS_TO_VIRT(LARGE_PAGE_SIZE), len);
+	u32 large_cycles = bench_walk(PHYS_TO_VIRT(LARGE_PAGE_SIZE), len);
+	u32 small_cycles = bench_walk((u8 *) BENCH_WINDOW, len);
+
+	// each walk touches every page of the range, so it needs one tlb entry per page it is mapped with
+	kprintf("walking %dK: 4M pages %d cycles/read (%d tlb entries), 4K pages %d cycles/read (%d tlb entries)\n",
+	        len / 1024,
+	        large_cycles,
+	        (len + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE,
+	        small_cycles,
+	        len / PAGE_SIZE);
+
+	// and tear down the 4K mappings. nothing but the kernel's own address space exists yet to share them with
+	for (u32 off = 0; off < len; off += PAGE_SIZE)
+		asm volatile("invlpg (%0)" :: "r"(BENCH_WINDOW + off) : "memory");
+
+	for (u32 i = BENCH_WINDOW >> 22; i <= (BENCH_WINDOW + len - 1) >> 22; i++)
+	{
+		pmm_free(PAGE_DIR[i] & PT_FRAME);
+		PAGE_DIR[i] = 0;
+	}
+}
+
+/**
+ * @brief runs 1, 2, 4, ... copies of the cpu bound spin program at once, up to twice as many as
+ * there are cpus, and reports how much more work gets done in the same time as the count goes up
+ * runs as a kernel thread, once the scheduler is running on every cpu
+ */
+static int bench_sched(void *arg)
+{
+	(void) arg;
+	kprintf("\tSCHED BENCHMARK\n");
+
+	int pids[BENCH_PROCS];
+	u32 single = 0;
+	for (int n = 1; n <= 2 * ncpu; n *= 2)
+	{
+		u32 start = uptime_ms();
+		for (int i = 0; i < n; i++)
+		{
+			struct proc *pptr = create_usermode("spin");
+			pids[i] = pptr ? pptr->pid : -1;
+			if (pptr)
+				ready(pptr);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			while (find_proc(pids[i]))
+				sleepms(10);
+		}
+
+		u32 ms = uptime_ms() - start;
+		if (ms == 0)
+			ms = 1;
+
+		if (n == 1)
+			single = ms;
+
+		// every process does the same work, so n of them finishing in the time one takes is n times the throughput
+		u32 speedup = n * single * 100 / ms;
+		kprintf("%d procs on %d cpus: %d ms, %d.%d%d times the throughput of 1\n",
+		        n, ncpu, ms, speedup / 100, speedup / 10 % 10, speedup % 10);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief runs every benchmark
+ */
+void bench()
+{
+	bench_pmm();
+	bench_vmm();
+	kthread_create(bench_sched, NULL, "sbench");
+}
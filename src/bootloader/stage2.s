@@ -8,7 +8,8 @@
 ; DESCRIPTION: stage 2 bootloader
 ;    detects the physical memory map,
 ;    moves the kernel to 1M physical,
-;    maps the kernel to 0xc0000000 virtual,
+;    maps the first 4M of physical memory to 0xc0000000 virtual,
+;    so the kernel is at 0xc0100000,
 ;    enables paging,
 ;    & jumps to the kernel
 ;
@@ -131,11 +132,11 @@ inc esi                                        ; i++
 jmp fill_ident_page_table
 .done:
 
-; map 4M of kernel to its virtual address 0xc0000000
+; map the first 4M of physical memory to 0xc0000000, where the kernel expects the direct map of physical memory to be
 ; maps virtual addresses 0xc0000000 - 0xc0400000
-; to physical addresses  0x00100000 - 0x00500000
+; to physical addresses  0x00000000 - 0x00400000
 ;
-; again, if kernel grows larger than 4M this will need to be looked at
+; again, if kernel grows larger than 3M this will need to be looked at
 
 ; point page directory entry which controls our kernel's virtual address to the page table we set up for it
 lea ebx, [KERNEL_PAGE_TABLE_BASE]              ; ebx = addr of kernel page table that will map these 4M 
@@ -154,7 +155,6 @@ cmp esi, 1024                                  ; while (i < 1024)
 je .done
 mov eax, esi                                   ; eax = i
 mul ecx                                        ; eax = i * 4096 (addr of current frame)
-add eax, KERNEL_NEW_BASE                       ; add kernel's physical base to eax
 or eax, 3                                      ; present, rw, kernel memory
 mov [KERNEL_PAGE_TABLE_BASE + 4 * esi], eax    ; kernel_page_table[i] = eax
 
@@ -175,11 +175,11 @@ mov cr0, eax
 ; 0x00000000 - 0x00100000 (physical)
 ;
 ; 0xc0000000 - 0xc0400000 (virtual) is mapped to
-; 0x00100000 - 0x00500000 (physical)
+; 0x00000000 - 0x00400000 (physical)
 ;
 ; all other addresses are unmapped, and accessing them will cause a page fault.
 
-jmp KERNEL_VIRT_BASE
+jmp KERNEL_VIRT_BASE + KERNEL_NEW_BASE
 
 ; tell nasm remainder of this file is 16 bit mode
 [bits 16]
@@ -283,7 +283,7 @@ KERNEL_PAGE_TABLE_BASE equ 0a000h            ; address of kernel's page table
 KERNEL_LOAD_BASE       equ 10000h            ; address where kernel was loaded by stage1
 KERNEL_NEW_BASE        equ 100000h           ; address where linker expects kernel to be loaded by stage2 (1M)
 
-KERNEL_VIRT_BASE       equ 0xc0000000        ; virtual address of start of kernel
+KERNEL_VIRT_BASE       equ 0xc0000000        ; virtual address of start of physical memory
 PAGE_SIZE              equ  1000h            ; size of page in bytes
 
 ; stage1 only loads 1 block (1024 bytes) of stage2 into memory.
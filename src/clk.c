@@ -6,6 +6,14 @@
  * FILE: clk.c
  * DATE: August 2nd, 2021
  * DESCRIPTION: Controllers for the PIT
+ *
+ * The PIT drives the scheduler and the ms clock. For finer grained time, the cpu's timestamp
+ * counter is calibrated against PIT channel 2 at boot, which gives a monotonic clock with
+ * nanosecond resolution that is independent of interrupts.
+ *
+ * Only the boot cpu gets PIT interrupts, so it alone keeps time and wakes sleeping processes.
+ * The interrupt itself only advances the clock and charges the tick to the running process.
+ * Waking sleepers and expiring timers is left to the timer softirq.
  */
 #include <clk.h>
 
@@ -15,67 +23,275 @@
 #include <proc.h>
 #include <pq.h>
 #include <queue.h>
+#include <smp.h>
+#include <softirq.h>
+#include <spinlock.h>
+#include <timer.h>
 
 // base frequency of the PIT, in Hz
 #define PIT_BASE_RATE 1193180
 
-static u64 sec = 0;    // seconds since maestro was bootstrapped
-static int ms  = 0;    // ms since sec was last updated
+// pit ticks in a ms
+#define PIT_PER_MS    (PIT_BASE_RATE / 1000)
+
+// longest one shot in ms the pit's 16 bit counter can count down
+#define NOHZ_MAX_MS   (0xffff / PIT_PER_MS)
+
+// ms since maestro was bootstrapped. a single word, so other cpus can read it while the boot cpu updates it
+static volatile u32 uptime = 0;
+
+// timestamp every process was last boosted back to its base priority level at
+static u32 last_boost = 0;
+
+// set while the pit is programmed to interrupt once after oneshot_ms, rather than every ms
+static bool oneshot = false;
+static u32 oneshot_ms;
 
-extern struct queue *readyq;
-extern struct pq *sleepq;
-extern struct proc *curr;
+// pit ticks left over after the last idle period was converted to ms
+static u32 residue;
+
+// timestamp counter frequency in kHz (ticks per ms), or 0 if the cpu has no timestamp counter
+static u32 tsc_freq;
+
+// value of the timestamp counter at boot
+static u64 tsc_boot;
+
+// length in ms of the tsc calibration. longer is more precise but slows down boot
+#define CALIBRATE_MS  10
+
+extern struct pq sleepq;
 
 /**
  * @brief total number of ms since maestro was bootstrapped
  */
 static inline u32 timestamp()
 {
-	return sec * 1000 + ms;
+	return uptime;
+}
+
+/**
+ * @brief number of ms since maestro was bootstrapped
+ */
+u32 uptime_ms()
+{
+	return timestamp();
+}
+
+// advances the clock by n ms
+static void advance(u32 n)
+{
+	uptime += n;
 }
 
-static int sleep_cmp(void *p1, void *p2)
+// programs the pit to interrupt once every ms
+static void pit_periodic()
 {
-	struct proc *pptr1 = (struct proc *) p1;
-	struct proc *pptr2 = (struct proc *) p2;
-	return pptr1->wakeup < pptr2->wakeup;
+	// channel 0, lo/hi byte, mode 2 (rate generator)
+	outb(0x43, 0x34);
+	outb(0x40, PIT_PER_MS >> 0 & 0xFF);
+	outb(0x40, PIT_PER_MS >> 8 & 0xFF);
+}
+
+// programs the pit to interrupt once, after count pit ticks
+static void pit_oneshot(u16 count)
+{
+	// channel 0, lo/hi byte, mode 0 (interrupt on terminal count)
+	outb(0x43, 0x30);
+	outb(0x40, count >> 0 & 0xFF);
+	outb(0x40, count >> 8 & 0xFF);
 }
 
 static void clkhandler()
 {
-	// wake up sleeping process if necessary
-	struct proc *pptr = (struct proc *) peek(&sleepq);
-	if (pptr && pptr->wakeup <= timestamp())
+	// a one shot firing means the whole idle period has passed,
+	// so catch the clock up and go back to ticking every ms
+	u32 elapsed = 1;
+	if (oneshot)
+	{
+		elapsed = oneshot_ms;
+		oneshot = false;
+		pit_periodic();
+	}
+
+	advance(elapsed);
+	raise_softirq(SOFTIRQ_TIMER);
+
+	// let the scheduler charge the tick, and preempt if the time slice is up
+	sched_tick();
+}
+
+// the rest of the work of a clock interrupt, run once it has returned
+static void clk_softirq()
+{
+	u32 now = timestamp();
+
+	// wake up every sleeping process whose time has come
+	int mask = spin_lock(&sched_lock);
+	struct pqnode *node;
+	while ((node = peek(&sleepq)) && (s32) (node->key - now) <= 0)
 	{
 		pop(&sleepq);
-		pptr->state = PR_READY;
-		pptr->wakeup = 0;
-		insert(readyq, pptr);
+		ready(pq_entry(node, struct proc, sleepnode));
 	}
 
-	if (++ms == 1000)
+	spin_unlock(&sched_lock, mask);
+
+	timer_tick(now);
+
+	if (now - last_boost >= MLFQ_BOOST_MS)
 	{
-		++sec;
-		ms = 0;
-		sched();
+		last_boost = now;
+		sched_boost();
 	}
 }
 
+/**
+ * @brief measures how fast the timestamp counter ticks, by counting its ticks
+ * over CALIBRATE_MS ms of PIT channel 2, which doesn't need interrupts
+ * @return timestamp counter frequency in kHz
+ */
+static u32 tsc_calibrate()
+{
+	u64 t0 = rdtsc();
+	udelay(CALIBRATE_MS * 1000);
+	u64 t1 = rdtsc();
+	return (t1 - t0) / CALIBRATE_MS;
+}
+
+/**
+ * @brief busy waits on PIT channel 2, which works with interrupts disabled and before the clock is running
+ * @param us number of microseconds to wait, up to 54000
+ */
+void udelay(u32 us)
+{
+	// gate channel 2 on, with the speaker off
+	outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+
+	// channel 2, lo/hi byte, mode 0 (interrupt on terminal count)
+	u16 count = us * PIT_PER_MS / 1000;
+	outb(0x43, 0xb0);
+	outb(0x42, count >> 0 & 0xFF);
+	outb(0x42, count >> 8 & 0xFF);
+
+	// the output of channel 2 (bit 5) goes high once the count reaches 0
+	while (!(inb(0x61) & 0x20))
+		;
+}
+
 // init clk
 void clk_init()
 {
 	set_vect(IRQ0, clkhandler);
+	open_softirq(SOFTIRQ_TIMER, clk_softirq);
+
+	// the timestamp counter is cpuid 1, edx bit 4
+	u32 eax, ebx, ecx, edx;
+	asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+	if (edx & (1 << 4))
+	{
+		tsc_freq = tsc_calibrate();
+		tsc_boot = rdtsc();
+		kprintf("TSC: %d kHz\n", tsc_freq);
+	}
 
 	// we want our clock interrupt to trigger at a rate of 1000Hz,
-	// or once every 1ms. Hence we divide by 1000.
-	u32 divisor = PIT_BASE_RATE / 1000;
+	// or once every 1ms
+	pit_periodic();
+}
 
-	// Send the command byte.
-	outb(0x43, 0x36);
+/**
+ * @brief number of ns since maestro was bootstrapped
+ * comes from the timestamp counter when there is one, otherwise it only has ms resolution
+ */
+u64 clock_ns()
+{
+	if (!tsc_freq)
+		return (u64) uptime_ms() * 1000000;
+
+	// split the division so the multiplication can't overflow
+	u64 ticks = rdtsc() - tsc_boot;
+	return ticks / tsc_freq * 1000000 + ticks % tsc_freq * 1000000 / tsc_freq;
+}
+
+/**
+ * @brief timestamp counter frequency
+ * @return frequency in kHz, or 0 if the cpu has no timestamp counter
+ */
+u32 tsc_khz()
+{
+	return tsc_freq;
+}
+
+/**
+ * @brief stops the periodic tick until the next sleeping process or timer is due,
+ * called by the null process with interrupts disabled right before it halts
+ *
+ * the pit is programmed to interrupt once, at the earliest deadline (or as far out
+ * as its 16 bit counter reaches), instead of every ms. whatever wakes the cpu first,
+ * clk_resume() or the one shot interrupt puts the clock right and restarts the tick.
+ * the tick only stops while every cpu is idle, since the others rely on the boot cpu to keep time
+ */
+void clk_idle()
+{
+	if (oneshot || cpu_id() != 0 || !smp_others_idle())
+		return;
+
+	u32 now      = timestamp();
+	u32 deadline = timer_next_expiry();
+
+	int mask = spin_lock(&sched_lock);
+	struct pqnode *node = peek(&sleepq);
+	if (node && (s32) (node->key - deadline) < 0)
+		deadline = node->key;
+
+	spin_unlock(&sched_lock, mask);
+
+	// the next tick is soon enough anyway
+	s32 delay = deadline - now;
+	if (delay <= 1)
+		return;
 
-	// Send the frequency divisor.
-	outb(0x40, divisor >> 0 & 0xFF);
-	outb(0x40, divisor >> 8 & 0xFF);
+	if (delay > NOHZ_MAX_MS)
+		delay = NOHZ_MAX_MS;
+
+	oneshot_ms = delay;
+	oneshot    = true;
+	pit_oneshot(delay * PIT_PER_MS);
+}
+
+/**
+ * @brief restarts the periodic tick if the cpu was woken from clk_idle() by anything
+ * other than the one shot, and accounts for the time that passed while idle
+ */
+void clk_resume()
+{
+	// only the boot cpu ever stops the tick, and only it may touch the pit
+	int mask = disable();
+	if (!oneshot || cpu_id() != 0)
+	{
+		restore(mask);
+		return;
+	}
+
+	// latch and read the count left on channel 0
+	outb(0x43, 0x00);
+	u16 left = inb(0x40);
+	left    |= inb(0x40) << 8;
+
+	// the count wraps around after the one shot fires, in which case its interrupt is
+	// still pending and all of the idle period has passed
+	u32 total   = oneshot_ms * PIT_PER_MS;
+	u32 elapsed = left <= total ? total - left : total;
+
+	// keep the fraction of a ms left over, so repeated short idles don't lose time
+	elapsed   += residue;
+	residue    = elapsed % PIT_PER_MS;
+
+	oneshot = false;
+	pit_periodic();
+	advance(elapsed / PIT_PER_MS);
+
+	restore(mask);
 }
 
 /**
@@ -84,11 +300,38 @@ void clk_init()
  */
 void sleepms(uint msec)
 {
-	int mask = disable();
-	u32 wakeup = timestamp() + msec;
-	curr->wakeup = wakeup;
-	push(&sleepq, curr, sleep_cmp);
-	curr->state = PR_SLEEPING;
+	int mask = spin_lock(&sched_lock);
+	struct proc *pptr = this_cpu()->proc;
+	pptr->sleepnode.key = timestamp() + msec;
+
+	// a process left out of the sleep queue would never be woken up, so just return early
+	if (!push(&sleepq, &pptr->sleepnode))
+	{
+		spin_unlock(&sched_lock, mask);
+		return;
+	}
+
+	pptr->state = PR_SLEEPING;
 	sched();
-	restore(mask);
+	spin_unlock(&sched_lock, mask);
+}
+
+/**
+ * @brief wakes up a sleeping process before its time is up
+ * @param pptr process to wake
+ * @return true if the process was sleeping
+ */
+bool unsleep(struct proc *pptr)
+{
+	int mask = spin_lock(&sched_lock);
+	if (pptr->state != PR_SLEEPING)
+	{
+		spin_unlock(&sched_lock, mask);
+		return false;
+	}
+
+	pq_remove(&sleepq, &pptr->sleepnode);
+	ready(pptr);
+	spin_unlock(&sched_lock, mask);
+	return true;
 }
@@ -10,7 +10,9 @@
 [bits 32]
 
 	global ctxsw
+	global proc_entry
 	extern set_task
+	extern sched_entry
 
 ; cdecl - void ctxsw(void *pold, void *pnew)
 ctxsw:
@@ -27,6 +29,15 @@ ctxsw:
 	mov [eax], esp          ; save old stack
 	mov esp, [ecx]          ; move new stack into esp
 
+	; switch address spaces, but only if they differ, since
+	; writing cr3 flushes every non-global entry from the tlb
+	mov edx, [ecx + 8]      ; edx = pnew->pdir
+	mov eax, cr3
+	cmp eax, edx
+	je .same_pdir
+	mov cr3, edx
+.same_pdir:
+
 	; set new process's kernel stack in tss so it can be loaded
 	; when the process is preempted
 	mov edx, [ecx + 4]      ; edx = pnew->stkbtm
@@ -40,3 +51,10 @@ ctxsw:
 	pop ebx
 	pop ebp
 	ret
+
+; a new process's ctxsw returns here, rather than into the sched() a process
+; that ran before would return to, and then on into the process's entry point
+; cdecl - void proc_entry()
+proc_entry:
+	call sched_entry        ; release the lock sched() switched with
+	ret
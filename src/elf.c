@@ -13,13 +13,11 @@
 #include <ext2.h>
 #include <kmalloc.h>
 #include <kprintf.h>
-#include <pmm.h>
 #include <proc.h>
+#include <syscall.h>
 #include <vfs.h>
 #include <vmm.h>
 
-extern struct proc *curr;
-
 extern void enter_usermode(void *, void *);
 
 /**
@@ -29,6 +27,8 @@ extern void enter_usermode(void *, void *);
  */
 void run_elf()
 {
+    // the file system isn't safe to use from two cpus at once, so load under the same lock syscalls run under
+    int mask = spin_lock(&kernel_lock);
     int fd = vfs_open(curr->name);
     int inode = curr->ofile[fd]->n->inode;
     size_t s = ext2_filesize(inode);
@@ -42,20 +42,62 @@ void run_elf()
 	struct elf_phdr *phdr;
 
     phdr = &phdr_table[0];
+	uintptr_t loaded_end = 0;
 	for (uint i = 0; i < ehdr->e_phnum; i++)
 	{
 		phdr = &phdr_table[i];
-        for (unsigned j = 0; j <= phdr->p_memsz / PAGE_SIZE; j++)
-        {
-            uintptr_t phys = pmm_alloc();
-            vmm_map_page(phys, phdr->p_vaddr + j * PAGE_SIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
-        }
+		if (phdr->p_type != PT_LOAD)
+			continue;
+
+		// pages are faulted in as they are copied to, and whatever is past the
+		// file image (.bss) is left for the page fault handler to zero on first touch.
+		// the loader has to write every segment, so they all start out writable, and the ones
+		// that shouldn't be are protected once everything is loaded.
+		// if two segments share a page, the first one's region covers it
+		uintptr_t start = phdr->p_vaddr > loaded_end ? phdr->p_vaddr : loaded_end;
+		uintptr_t end   = phdr->p_vaddr + phdr->p_memsz;
+		if (start < end)
+		{
+			vmm_add_region(curr, start, end, VM_READ | VM_WRITE);
+			loaded_end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		}
+
+        memcpy((void *) phdr->p_vaddr, &buff[phdr->p_offset], phdr->p_filesz);
+	}
 
-        memcpy((void *) phdr->p_vaddr, &buff[phdr->p_offset], phdr->p_memsz);
+	// make text and read only data read only, unless a writable segment shares one of their pages
+	for (uint i = 0; i < ehdr->e_phnum; i++)
+	{
+		phdr = &phdr_table[i];
+		if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_W))
+			continue;
+
+		struct vm_region *region = vmm_find_region(curr, phdr->p_vaddr);
+		if (!region || !(region->flags & VM_WRITE))
+			continue;
+
+		bool shared = false;
+		for (uint j = 0; j < ehdr->e_phnum; j++)
+		{
+			struct elf_phdr *other = &phdr_table[j];
+			uintptr_t start = other->p_vaddr & ~(PAGE_SIZE - 1);
+			if (other->p_type == PT_LOAD && (other->p_flags & PF_W)
+			    && start < region->end && other->p_vaddr + other->p_memsz > region->start)
+				shared = true;
+		}
+
+		if (!shared)
+			vmm_protect_region(region);
 	}
 
+	// the header goes away with the buffer
+	void *entry = (void *) ehdr->e_entry;
     kfree(buff);
 
+    // the heap begins on the page after the highest segment
+    curr->brk_start = loaded_end;
+    curr->brk       = loaded_end;
+
     const char *argv[] = {
         "ls",
         "-lia",
@@ -63,9 +105,8 @@ void run_elf()
         NULL,
     };
 
-    void *env = (void *) (0xc0000000 - PR_STACKSIZE);
-    uintptr_t env_phys = pmm_alloc();
-    vmm_map_page(env_phys, (uintptr_t) env, PT_PRESENT | PT_WRITABLE | PT_USER);
+    void *env = (void *) USTACK_TOP;
+    vmm_add_region(curr, USTACK_TOP, USTACK_TOP + PR_STACKSIZE, VM_READ | VM_WRITE);
 
     const char **arg = argv;
     int argc = 0;
@@ -84,16 +125,16 @@ void run_elf()
 
     envp[argc] = NULL;
 
-    // create user stack and map it
-    uintptr_t ustack_phys = pmm_alloc();
-    vmm_map_page(ustack_phys, 0xc0000000 - 2 * PR_STACKSIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
-    u32 *ustack = (u32*) (0xc0000000 - PR_STACKSIZE);
+    // the user stack starts out as a single untouched page, and grows down as the process uses it
+    vmm_add_region(curr, USTACK_TOP - PAGE_SIZE, USTACK_TOP, VM_READ | VM_WRITE | VM_GROWSDOWN);
+    u32 *ustack = (u32*) USTACK_TOP;
     
     // place argc and argv on the stack
     --ustack; *ustack = (uintptr_t) env;
     --ustack; *ustack = argc;
 
-    enter_usermode(ustack, (void *) ehdr->e_entry);
+    spin_unlock(&kernel_lock, mask);
+    enter_usermode(ustack, entry);
 }
 
 void print_elf(struct elf_ehdr *ehdr)
@@ -537,7 +537,8 @@ int ext2_read_data(void *buff, u32 inum, size_t off, size_t count)
 		num_blocks++;
 
 	// list of data blocks to read
-	u32 *data_blocks = get_data_blocks(&inode, start_block, num_blocks);
+	u32 *blocks = get_data_blocks(&inode, start_block, num_blocks);
+	u32 *data_blocks = blocks;
 
 	// temporary buffer if reading from a non block-aligned offset
 	u8 tmp[EXT2_BLOCK_SIZE];
@@ -571,7 +572,8 @@ int ext2_read_data(void *buff, u32 inum, size_t off, size_t count)
 		read_block(tmp, *data_blocks, 1);
 		memcpy(buff, tmp, remaining);
 	}
-	
+
+	kfree(blocks);
 	return count;
 }
 /**
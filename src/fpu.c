@@ -0,0 +1,241 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: fpu.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: lazy switching of fpu and sse state between processes
+ *
+ * Most processes never touch the fpu, so its registers aren't switched along with the rest.
+ * Switching processes only sets cr0.ts, and the first fpu or sse instruction a process runs after
+ * that raises a device not available exception (#NM). Only then does the handler load the
+ * process's state into the registers, and the process has the fpu until it is switched away from.
+ * The area to save the state in is only allocated the first time a process uses the fpu,
+ * so a process that never does costs nothing more than before.
+ *
+ * A process's state is saved when it is switched away from, but only if it used the fpu during
+ * that time slice, since it may be picked up by another cpu next. The registers still hold the
+ * state afterwards, so if the process is the next one on this cpu to use the fpu, it gets the fpu
+ * back without loading anything. cpu->fpu_owner and proc->fpu_cpu together tell when that is.
+ *
+ * The kernel never uses the fpu itself, so it never has to save the state around its own code.
+ */
+#include <fpu.h>
+
+#include <intr.h>
+#include <kprintf.h>
+#include <proc.h>
+#include <slab.h>
+#include <smp.h>
+
+#include <string.h>
+
+#define CR0_MP         0x2      // wait and fwait trap with cr0.ts set too
+#define CR0_EM         0x4      // no fpu, every fpu instruction traps
+#define CR0_TS         0x8      // task switched, the next fpu instruction traps
+#define CR0_NE         0x20     // report fpu errors with #MF rather than the PIC
+
+#define CR4_OSFXSR     0x200    // enables fxsave, fxrstor, and sse instructions
+#define CR4_OSXMMEXCPT 0x400    // report sse errors with #XM
+
+#define CPUID_FXSR     (1 << 24)
+#define CPUID_SSE      (1 << 25)
+
+// device not available exception
+#define XINT_NM        7
+
+// mxcsr at reset, every sse exception masked
+#define MXCSR_DEFAULT  0x1f80
+
+// fxsave needs a 16 byte aligned area, but slab objects are only 8 byte aligned
+#define fxarea(pptr)   ((void *) (((uintptr_t) (pptr)->fpu + 15) & ~15))
+
+// fxsave areas of processes that have used the fpu
+static struct kmem_cache *fpu_cache;
+
+// whether the cpus have sse, and mxcsr has to be set up
+static bool has_sse;
+
+static bool fpu_trap(struct registers *);
+
+static inline u32 read_cr0()
+{
+	u32 cr0;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	return cr0;
+}
+
+// sets cr0.ts, so the next fpu instruction traps
+static inline void stts()
+{
+	asm volatile("mov %0, %%cr0" :: "r"(read_cr0() | CR0_TS));
+}
+
+static inline void clts()
+{
+	asm volatile("clts");
+}
+
+static inline void fxsave(struct proc *pptr)
+{
+	asm volatile("fxsave (%0)" :: "r"(fxarea(pptr)) : "memory");
+}
+
+static inline void fxrstor(struct proc *pptr)
+{
+	asm volatile("fxrstor (%0)" :: "r"(fxarea(pptr)) : "memory");
+}
+
+/**
+ * @brief turns on the fpu and sse for the calling cpu, with cr0.ts set
+ * the boot cpu calls this before any other, and sets up what they all share
+ */
+void fpu_init()
+{
+	u32 eax, ebx, ecx, edx;
+	asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+
+	// every cpu fxsave is around for has sse, so don't bother with the older fsave
+	if (!(edx & CPUID_FXSR))
+	{
+		kprintf("FPU: no fxsave, fpu disabled\n");
+		asm volatile("mov %0, %%cr0" :: "r"(read_cr0() | CR0_EM));
+		return;
+	}
+
+	if (cpu_id() == 0)
+	{
+		has_sse   = edx & CPUID_SSE;
+		fpu_cache = kmem_cache_create("fpu", FXSAVE_SIZE + 15, NULL);
+		set_xint(XINT_NM, fpu_trap);
+	}
+
+	u32 cr4;
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= CR4_OSFXSR;
+	if (has_sse)
+		cr4 |= CR4_OSXMMEXCPT;
+	asm volatile("mov %0, %%cr4" :: "r"(cr4));
+
+	u32 cr0 = (read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS;
+	asm volatile("mov %0, %%cr0" :: "r"(cr0));
+}
+
+/**
+ * @brief called by sched() before it switches processes, with sched_lock held
+ * @param pold process being switched away from
+ * @param pnew process being switched to
+ */
+void fpu_switch(struct proc *pold, struct proc *pnew)
+{
+	struct cpu *cpu = this_cpu();
+
+	// cr0.ts is only clear if the old process has had the fpu during this time slice
+	if (cpu->fpu_owner == pold && !(read_cr0() & CR0_TS))
+		fxsave(pold);
+
+	// nothing has replaced the new process's state since it last had the fpu here
+	if (cpu->fpu_owner == pnew && pnew->fpu_cpu == cpu->id)
+		clts();
+	else
+		stts();
+}
+
+/**
+ * @brief gives a forked child a copy of its parent's fpu state
+ * @param parent process making the call to fork
+ * @param child new process
+ */
+void fpu_fork(struct proc *parent, struct proc *child)
+{
+	if (!parent->fpu)
+		return;
+
+	// the parent's latest state may only be in the registers
+	int mask = disable();
+	if (this_cpu()->fpu_owner == parent && !(read_cr0() & CR0_TS))
+		fxsave(parent);
+	restore(mask);
+
+	child->fpu = kmem_cache_alloc(fpu_cache);
+	if (child->fpu)
+		memcpy(fxarea(child), fxarea(parent), FXSAVE_SIZE);
+}
+
+/**
+ * @brief frees the fpu state of a process that is exiting, called with sched_lock held
+ * @param pptr process making the call
+ */
+void fpu_exit(struct proc *pptr)
+{
+	if (!pptr->fpu)
+		return;
+
+	// sched() mustn't save to the area once it is freed
+	struct cpu *cpu = this_cpu();
+	if (cpu->fpu_owner == pptr)
+		cpu->fpu_owner = NULL;
+
+	kmem_cache_free(fpu_cache, pptr->fpu);
+	pptr->fpu = NULL;
+}
+
+/**
+ * @brief handles the first fpu instruction a process runs in a time slice
+ * a user process that can't be given the fpu is killed, rather than panicking the kernel
+ * @param regs state of the registers at the exception
+ * @return true once the process has the fpu, or false if it couldn't be given it
+ */
+static bool fpu_trap(struct registers *regs)
+{
+	struct cpu *cpu   = this_cpu();
+	struct proc *pptr = cpu->proc;
+
+	// the kernel never uses the fpu, so this has to be a process
+	if (pptr == cpu->idle)
+		return false;
+
+	// allocate before touching cr0.ts, so the registers are left to their owner if this fails
+	bool first = !pptr->fpu;
+	if (first)
+	{
+		pptr->fpu = kmem_cache_alloc(fpu_cache);
+		if (!pptr->fpu)
+		{
+			kprintf("%s (pid = %d): out of memory for fpu state\n", pptr->name, pptr->pid);
+
+			// the cpu pushes cs right after eip, and its low bits are the ring the trap came from
+			u32 cs = *(&regs->eip + 1);
+			if (cs & 3)
+				proc_exit(-1);
+
+			return false;
+		}
+	}
+
+	clts();
+
+	// the registers may still hold the state, if nothing took the fpu since the process last had it
+	if (cpu->fpu_owner == pptr && pptr->fpu_cpu == cpu->id)
+		return true;
+
+	// whatever the registers hold was saved when its process was switched away from
+	if (!first)
+		fxrstor(pptr);
+
+	// a process using the fpu for the first time starts out with it freshly initialized
+	else
+	{
+		asm volatile("fninit");
+		if (has_sse)
+		{
+			u32 mxcsr = MXCSR_DEFAULT;
+			asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+		}
+	}
+
+	cpu->fpu_owner = pptr;
+	pptr->fpu_cpu  = cpu->id;
+	return true;
+}
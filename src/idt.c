@@ -17,7 +17,6 @@
 struct idt_entry idt[256];
 
 static void set_idt(int, u32, u16, u8);
-static void lidt();
 
 struct idtr
 {
@@ -27,6 +26,7 @@ struct idtr
 
 // defined in intr.s
 extern void *ivect[];
+extern void spurious();
 
 // init idt
 void idt_init()
@@ -44,11 +44,17 @@ void idt_init()
 	// set syscall entry in idt
 	set_idt(48, (u32) ivect[48], 0x8, 0xee);
 
-	lidt();
+	// set local apic entries in idt
+	set_idt(LAPIC_TIMER, (u32) ivect[LAPIC_TIMER], 0x8, 0x8e);
+	set_idt(IPI_RESCHED, (u32) ivect[IPI_RESCHED], 0x8, 0x8e);
+	set_idt(LAPIC_SPURIOUS, (u32) spurious, 0x8, 0x8e);
+
+	idt_load();
 }
 
 // stores idt structure in idtr
-static void lidt()
+// every cpu shares the same idt, so the aps only have to load it
+void idt_load()
 {
 	idtr.limit = sizeof(idt) - 1;
 	idtr.base  = (u32) &idt;
@@ -9,8 +9,10 @@
  */
 #include <init.h>
 
+#include <bench.h>
 #include <clk.h>
 #include <ext2.h>
+#include <fpu.h>
 #include <idt.h>
 #include <intr.h>
 #include <kbd.h>
@@ -18,9 +20,12 @@
 #include <pmm.h>
 #include <proc.h>
 #include <sem.h>
+#include <smp.h>
+#include <timer.h>
 #include <vfs.h>
 #include <vmm.h>
 #include <w.h>
+#include <workqueue.h>
 
 // initializes IDT, interrupts, and the clock
 void init()
@@ -30,6 +35,7 @@ void init()
 	clk_init();
 	pmm_init();
 	vmm_init();
+	fpu_init();
 	sem_init();
 	//w_init();
 
@@ -37,8 +43,15 @@ void init()
     vfs_init();
 
 	proc_init();
+	timers_init();
+	workqueue_init();
+	smp_init();
 	//mouse_init();
 
 	// set keyboard interrupt handler
-	set_vect(IRQ1, kbdhandler);
+	kbd_init();
+
+#ifdef BENCH
+	bench();
+#endif
 }
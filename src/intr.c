@@ -13,6 +13,10 @@
 #include <io.h>
 #include <kprintf.h>
 #include <maestro.h>
+#include <proc.h>
+#include <smp.h>
+#include <softirq.h>
+#include <spinlock.h>
 #include <syscall.h>
 
 #define PIC1 0x20    // pic1 command port
@@ -27,6 +31,9 @@ extern void (*user_handlers[])(void);
 // defined in syscall.c
 extern void (*syscall_handlers[])(struct registers *);
 
+// handlers that may be able to recover from an exception
+static bool (*xint_handlers[IRQ0])(struct registers *);
+
 // exception messages
 static const char *xint_msg[] = {
 	"divide error",
@@ -63,6 +70,49 @@ static const char *xint_msg[] = {
 	"reserved",
 };
 
+/**
+ * @brief registers a handler for an exception
+ * the handler returns true if it resolved the exception, in which case the
+ * interrupted code resumes. otherwise, the kernel panics like it would with no handler
+ * @param xint exception number
+ * @param handler function called when the exception occurs
+ */
+void set_xint(u8 xint, bool (*handler)(struct registers *))
+{
+	xint_handlers[xint] = handler;
+}
+
+/**
+ * @brief reports an unrecoverable exception and halts
+ * @param regs state of the registers when the exception occurred
+ */
+static void xint_panic(struct registers *regs)
+{
+	u8 intr = regs->intr_num;
+
+	u32 cr2;
+	asm("mov %%cr2, %0" : "=r"(cr2));
+
+	kprintf("cr2=0x%x\n", cr2);
+	kprintf("\n");
+	kprintf("\tMAESTRO PANIC!!!\n");
+	kprintf("Exception %d: %s\n", intr, xint_msg[intr]);
+	kprintf("Error code: %d\n", regs->error_code);
+	kprintf("registers: \n");
+	kprintf("eax: 0x%x\n", regs->eax);
+	kprintf("ebx: 0x%x\n", regs->ebx);
+	kprintf("ecx: 0x%x\n", regs->ecx);
+	kprintf("edx: 0x%x\n", regs->edx);
+	kprintf("esi: 0x%x\n", regs->esi);
+	kprintf("edi: 0x%x\n", regs->edi);
+	kprintf("ebp: 0x%x\n", regs->ebp);
+	kprintf("esp: 0x%x\n", regs->esp);
+	kprintf("eip: 0x%x\n", regs->eip);
+
+	while (1)
+		;
+}
+
 /**
  * @brief high level interrupt handler
  * common assembly code in intr.s bootstraps the handler
@@ -78,27 +128,10 @@ void isr(struct registers *regs)
 	// exception
 	if (intr < IRQ0)
 	{
-		u32 cr2;
-		asm("mov %%cr2, %0" : "=r"(cr2));
-
-		kprintf("cr2=0x%x\n", cr2);
-		kprintf("\n");
-		kprintf("\tMAESTRO PANIC!!!\n");
-		kprintf("Exception %d: %s\n", intr, xint_msg[intr]);
-		kprintf("Error code: %d\n", regs->error_code);
-		kprintf("registers: \n");
-		kprintf("eax: 0x%x\n", regs->eax);
-		kprintf("ebx: 0x%x\n", regs->ebx);
-		kprintf("ecx: 0x%x\n", regs->ecx);
-		kprintf("edx: 0x%x\n", regs->edx);
-		kprintf("esi: 0x%x\n", regs->esi);
-		kprintf("edi: 0x%x\n", regs->edi);
-		kprintf("ebp: 0x%x\n", regs->ebp);
-		kprintf("esp: 0x%x\n", regs->esp);
-		kprintf("eip: 0x%x\n", regs->eip);
-
-		while (1)
-			;
+		// give a registered handler the chance to resolve the exception first
+		bool (*handler)(struct registers *) = xint_handlers[intr];
+		if (!handler || !handler(regs))
+			xint_panic(regs);
 	}
 
 	// syscall
@@ -112,22 +145,43 @@ void isr(struct registers *regs)
 				;
 		}
 
+		// system calls run one at a time, under the kernel lock
 		void (*handler)(struct registers *) = syscall_handlers[sysno];
+		int kmask = spin_lock(&kernel_lock);
 		handler(regs);
+		spin_unlock(&kernel_lock, kmask);
 	}
 
-	// irq
-	else
+	// local apic interrupt
+	else if (intr > SYSCALL)
 	{
-		// call registered handler on irq
+		lapic_eoi();
+
 		void (*handler)(void) = user_handlers[intr];
 		handler();
+	}
 
-		// acknowledge interrupt with eoi
+	// irq
+	else
+	{
+		// acknowledge interrupt with eoi before calling the handler, since the handler
+		// may switch to another process (the clock preempting), which could run for a long
+		// time before this one gets back here. interrupts stay disabled until the iret either way
 		outb(PIC1, EOI);
 
 		if (intr > IRQ8)
 			outb(PIC2, EOI);
+
+		// call registered handler on irq
+		void (*handler)(void) = user_handlers[intr];
+		handler();
+	}
+
+	// run the work the handler deferred, and switch away from the idle process if it readied anything here
+	if (intr >= IRQ0 && intr != SYSCALL)
+	{
+		do_softirq();
+		sched_wakeup();
 	}
 
 	restore(mask);
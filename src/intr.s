@@ -39,6 +39,7 @@
 	global disable
 	global restore
 	global isr_end
+	global spurious
 
 
 	extern io_wait
@@ -334,6 +335,20 @@ sysc:
 	push 48
 	jmp isr_bootstrap
 
+; local apic interrupts
+lapic_timer:
+	push 0
+	push 49
+	jmp isr_bootstrap
+resched:
+	push 0
+	push 50
+	jmp isr_bootstrap
+
+; a spurious interrupt from the local apic must not be acknowledged, so there is nothing to do
+spurious:
+	iret
+
 ; bootstrap the C isr handler
 ; before jumping here, an error code (or dummy 0) and interrupt number were just pushed onto the stack
 ; handler will save the program state with pusha, so the stack will look like this:
@@ -428,6 +443,8 @@ ivect:
 	dd irq14
 	dd irq15
 	dd sysc
+	dd lapic_timer
+	dd resched
 
 mystr:
 	db 'hello world', 0
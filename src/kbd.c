@@ -9,8 +9,10 @@
  */
 #include <kbd.h>
 
+#include <intr.h>
 #include <io.h>
 #include <tty.h>
+#include <workqueue.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,10 +22,56 @@ static u32 state = 0;
 
 #define PRESSED(k) (state & (k))
 
+// scancodes read by the interrupt handler, waiting for kbd_work to decode them.
+// only the handler advances head and only kbd_work advances tail, so they need no lock
+static volatile u8 scancodes[KBD_BUFSIZE];
+static volatile u32 head = 0;
+static volatile u32 tail = 0;
+
+static struct work kbd_work;
+
+static void kbd_decode(void *);
+static void kbd_key(u8);
+
+void kbd_init()
+{
+	work_init(&kbd_work, kbd_decode, NULL);
+	set_vect(IRQ1, kbdhandler);
+}
+
+/**
+ * @brief keyboard interrupt handler
+ * reading the scancode is all that acknowledges the keyboard, so that is all it does here.
+ * decoding it and waking up the tty's reader is left to the worker thread
+ */
 void kbdhandler()
 {
 	u8 scancode = inb(KBD_IN);
 
+	// drop keys when the buffer is full, like the keyboard's own buffer does
+	if (head - tail < KBD_BUFSIZE)
+	{
+		scancodes[head % KBD_BUFSIZE] = scancode;
+		head++;
+	}
+
+	queue_work(&kbd_work);
+}
+
+// decodes every scancode buffered since the last time it ran
+static void kbd_decode(void *arg)
+{
+	(void) arg;
+	while (tail != head)
+	{
+		kbd_key(scancodes[tail % KBD_BUFSIZE]);
+		tail++;
+	}
+}
+
+// updates the shift state with a scancode, and passes on the character it stands for
+static void kbd_key(u8 scancode)
+{
 	if (scancode >= NUM_KEYS)
 		return;
 
@@ -7,10 +7,12 @@
  * DATE: July 26, 2021
  * DESCRIPTION: Where it all begins
  */
+#include <clk.h>
 #include <init.h>
 #include <intr.h>
 #include <kmalloc.h>
 #include <kprintf.h>
+#include <pmm.h>
 #include <proc.h>
 
 #include <elf.h>
@@ -18,23 +20,37 @@
 #include <stdio.h>
 #include <string.h>
 
-extern struct proc *curr;
-extern struct proc nullproc;
-
 void kmain()
 {
 	kprintf("Welcome to maestro!\n");
 	init();
-	curr = &nullproc;
 
     struct proc *msh = create_usermode("msh");
+    if (!msh)
+    {
+        kprintf("kmain: couldn't create msh!\n");
+        while (1) ;
+    }
+
     ready(msh);
 
 	// enable interrupts
 	asm("sti");
     sched();
 
-	// become the null process
+	// become the null process, which zeroes free memory ahead of time
+	// whenever there is nothing else to do, and only halts once there is none left to zero
 	while (1)
-		asm("hlt");
+	{
+		if (pmm_refill_zero_pool())
+			continue;
+
+		// stop the tick until something is due. sti only takes effect after the next
+		// instruction, so no interrupt can slip in between it and the hlt and leave us halted
+		int mask = disable();
+		clk_idle();
+		asm("sti; hlt");
+		clk_resume();
+		restore(mask);
+	}
 }
@@ -6,27 +6,125 @@
  * FILE: kmalloc.c
  * DATE: March 14th, 2022
  * DESCRIPTION: Implentation of a kernel heap
+ *
+ * The heap is a single arena carved into blocks. Every block begins with a
+ * struct header that records its own size and the size of the block to its left,
+ * so a freed block can find and merge with both of its neighbors in constant time
+ * (boundary tag coalescing). The arena is bookended by two fenceposts which are
+ * never free, so coalescing never walks off the edge of the heap.
+ *
+ * Free blocks live in N_LISTS segregated freelists. Small blocks are binned by exact size,
+ * and a bitmap records which lists are non-empty, so finding a block for a small
+ * request is a single bit scan followed by a list pop.
  */
 #include <kmalloc.h>
 
+#include <intr.h>
 #include <kprintf.h>
+#include <meminfo.h>
+#include <spinlock.h>
 #include <vmm.h>
 
-// freelist sentinal - denotes the head of the doubly-linked freelist
-static struct header *sentinal;
+// freelist sentinals - each one denotes the head of a doubly-linked freelist
+static struct header freelists[N_LISTS];
+
+// set bit n denotes freelist n is not empty
+static u32 freelist_map[N_LISTS / 32];
 
 // pointers to the base of the heap, and current top
 void *base, *heap;
 
+// one past the final byte of the heap arena
+static void *top;
+
+// bytes and blocks currently allocated in each size class, for meminfo
+static u32 class_bytes[KMALLOC_NCLASSES];
+static u32 class_count[KMALLOC_NCLASSES];
+
+// protects the heap and its freelists
+static struct spinlock kmalloc_lock = SPINLOCK_INIT("kmalloc");
+
 // rounds an number x up to the nearest multiple of 8
 #define round8(x) ((x + 7) & ~0x7);
 
 static void insert_into_freelist(struct header *);
+static void remove_from_freelist(struct header *);
+static struct header *find_free_block(size_t);
+static void split_block(struct header *, size_t);
+static void free_block(struct header *);
+
+static inline size_t get_freelist_index(size_t block_size)
+{
+	size_t allocable_size = block_size - ALLOC_HEADER_SIZE;
+
+	if (allocable_size > (N_LISTS - 1) * 8)
+		return N_LISTS - 1;
+
+	return (allocable_size / 8) - 1;
+}
+
+// size class an allocated block is counted in
+static inline uint get_size_class(size_t block_size)
+{
+	uint class = 0;
+	while (class < KMALLOC_NCLASSES - 1 && block_size > (size_t) KMALLOC_CLASS_MIN << class)
+		class++;
+
+	return class;
+}
 
+// counts a block as allocated (delta 1) or no longer allocated (delta -1)
+static inline void account(struct header *h, int delta)
+{
+	uint class = get_size_class(get_block_size(h));
+	class_bytes[class] += delta * (int) get_block_size(h);
+	class_count[class] += delta;
+}
+
+static inline bool is_freelist_empty(size_t idx)
+{
+	return freelists[idx].next == &freelists[idx];
+}
+
+static inline void initialize_fencepost(struct header *fp, size_t left_size)
+{
+	fp->size_state = ALLOC_HEADER_SIZE | FENCEPOST;
+	fp->left_size  = left_size;
+}
+
+/**
+ * @brief initializes the kernel heap
+ * @param p base address of the heap arena
+ * @param s size in bytes of the heap arena
+ */
 void kmalloc_init(void *p, size_t s)
 {
 	base = p;
 	heap = p;
+	top  = (u8 *) p + s;
+
+	for (int i = 0; i < N_LISTS; i++)
+	{
+		freelists[i].size_state = SENTINAL;
+		freelists[i].next       = &freelists[i];
+		freelists[i].prev       = &freelists[i];
+	}
+
+	for (int i = 0; i < N_LISTS / 32; i++)
+		freelist_map[i] = 0;
+
+	// place a fencepost at each end of the arena, then everything between them is one big free block
+	struct header *left_fencepost  = (struct header *) base;
+	struct header *right_fencepost = get_header_from_offset(top, -ALLOC_HEADER_SIZE);
+	struct header *block           = get_header_from_offset(base, ALLOC_HEADER_SIZE);
+	size_t block_size              = s - 2 * ALLOC_HEADER_SIZE;
+
+	initialize_fencepost(left_fencepost, 0);
+	block->size_state = block_size | UNALLOCATED;
+	block->left_size  = ALLOC_HEADER_SIZE;
+	initialize_fencepost(right_fencepost, block_size);
+
+	insert_into_freelist(block);
 
 	(void) print_heap;
 	(void) print_freelist;
@@ -42,54 +140,250 @@ void *kmalloc(size_t size)
 	if (size == 0)
 		return NULL;
 
-	void *ptr = heap;
-	heap += round8(size);
-	return ptr;
+	size_t request_size = round8(size + ALLOC_HEADER_SIZE);
+	if (request_size < sizeof(struct header))
+		request_size = sizeof(struct header);
+
+	// the heap is shared with interrupt handlers
+	int mask = spin_lock(&kmalloc_lock);
+
+	struct header *block = find_free_block(request_size);
+	if (!block)
+	{
+		spin_unlock(&kmalloc_lock, mask);
+		kprintf("kmalloc: out of memory! (request for %d bytes)\n", size);
+		return NULL;
+	}
+
+	remove_from_freelist(block);
+	split_block(block, request_size);
+
+	set_block_state(block, ALLOCATED);
+	account(block, 1);
+	spin_unlock(&kmalloc_lock, mask);
+	return block->data;
 }
 
+/**
+ * @brief allocates memory on the kernel's heap with a given alignment
+ * @param size the size in bytes of the request
+ * @param alignment power of 2 the returned pointer will be a multiple of
+ * @return pointer to the first usable data byte of the request
+ */
 void *kmalloc_a(size_t size, size_t alignment)
 {
-	while ((uintptr_t) heap % alignment != 0)
-		heap += 1;
+	// every block is already 8 byte aligned
+	if (alignment <= 8)
+		return kmalloc(size);
+
+	// over allocate so there is always room to slide forward to an aligned address
+	// and still leave a whole free block behind
+	u8 *raw = kmalloc(size + alignment + sizeof(struct header));
+	if (!raw)
+		return NULL;
+
+	if ((uintptr_t) raw % alignment == 0)
+		return raw;
+
+	int mask = spin_lock(&kmalloc_lock);
+
+	// split the leading gap off into its own block and free it
+	uintptr_t aligned = ((uintptr_t) raw + sizeof(struct header) + alignment - 1) & -alignment;
+	struct header *h  = get_header_from_offset(raw, -ALLOC_HEADER_SIZE);
+	struct header *ah = get_header_from_offset((void *) aligned, -ALLOC_HEADER_SIZE);
+	size_t gap        = (uintptr_t) ah - (uintptr_t) h;
+	account(h, -1);
+
+	ah->size_state = (get_block_size(h) - gap) | ALLOCATED;
+	ah->left_size  = gap;
+	get_right_header(ah)->left_size = get_block_size(ah);
+	set_block_size(h, gap);
+	free_block(h);
 
-	return kmalloc(size);
+	// and give back whatever is left over past the end of the request
+	size_t request_size = round8(size + ALLOC_HEADER_SIZE);
+	if (request_size < sizeof(struct header))
+		request_size = sizeof(struct header);
+
+	split_block(ah, request_size);
+	account(ah, 1);
+
+	spin_unlock(&kmalloc_lock, mask);
+	return ah->data;
 }
 
 /**
  * @brief deallocates memory from the kernel's heap
  * @param p pointer to user's data that was returned by kmalloc
  */
-void kfree(void *p) { }
+void kfree(void *p)
+{
+	if (!p)
+		return;
+
+	struct header *h = get_header_from_offset(p, -ALLOC_HEADER_SIZE);
+
+	if (get_block_state(h) != ALLOCATED)
+	{
+		kprintf("kfree: 0x%x is not an allocated block!\n", p);
+		return;
+	}
+
+	int mask = spin_lock(&kmalloc_lock);
+	account(h, -1);
+	free_block(h);
+	spin_unlock(&kmalloc_lock, mask);
+}
 
 /**
- * @brief inserts a header in the front of a freelist
- * @param h header to insert
+ * @brief shrinks a block to a requested size, returning the remainder to a freelist
+ * if the remainder is large enough to be its own block
+ * @param h header of the block to split
+ * @param request_size size in bytes the block should be shrunk to
  */
-static void insert_into_freelist(struct header *h)
+static void split_block(struct header *h, size_t request_size)
+{
+	size_t block_size = get_block_size(h);
+	if (block_size - request_size < sizeof(struct header))
+		return;
+
+	struct header *rem = get_header_from_offset(h, request_size);
+	rem->size_state    = (block_size - request_size) | UNALLOCATED;
+	rem->left_size     = request_size;
+	set_block_size(h, request_size);
+
+	// the remainder could border a free block if h came from kmalloc_a
+	struct header *right = get_right_header(rem);
+	if (get_block_state(right) == UNALLOCATED)
+	{
+		remove_from_freelist(right);
+		set_block_size(rem, get_block_size(rem) + get_block_size(right));
+	}
+
+	get_right_header(rem)->left_size = get_block_size(rem);
+	insert_into_freelist(rem);
+}
+
+/**
+ * @brief marks a block unallocated, merging it with any free neighbors
+ * @param h header of the block to free
+ */
+static void free_block(struct header *h)
 {
-	// freelist is empty
-	if (sentinal->next == sentinal)
+	struct header *left  = get_left_header(h);
+	struct header *right = get_right_header(h);
+
+	set_block_state(h, UNALLOCATED);
+
+	if (get_block_state(right) == UNALLOCATED)
+	{
+		remove_from_freelist(right);
+		set_block_size(h, get_block_size(h) + get_block_size(right));
+	}
+
+	if (get_block_state(left) == UNALLOCATED)
+	{
+		remove_from_freelist(left);
+		set_block_size(left, get_block_size(left) + get_block_size(h));
+		h = left;
+	}
+
+	get_right_header(h)->left_size = get_block_size(h);
+	insert_into_freelist(h);
+}
+
+/**
+ * @brief finds a free block large enough to satisfy a request
+ * @param request_size size in bytes of the block needed, including its header
+ * @return header of a free block at least request_size bytes, or NULL if none exists
+ */
+static struct header *find_free_block(size_t request_size)
+{
+	size_t idx = get_freelist_index(request_size);
+
+	// every block in a list at or above idx is large enough,
+	// so the first non-empty list is the one to allocate from
+	for (size_t word = idx / 32; word < N_LISTS / 32; word++)
 	{
-		sentinal->prev = h;
-		sentinal->next = h;
-		h->prev        = sentinal;
-		h->next        = sentinal;
+		u32 bits = freelist_map[word];
+		if (word == idx / 32)
+			bits &= ~0u << (idx % 32);
+
+		if (bits == 0)
+			continue;
+
+		size_t list = word * 32 + __builtin_ctz(bits);
+
+		// small requests are always satisfied by the head of the catch-all list too,
+		// only a request that itself belongs in the catch-all list needs to search it
+		if (list != N_LISTS - 1 || idx != N_LISTS - 1)
+			return freelists[list].next;
+
+		struct header *sentinal = &freelists[N_LISTS - 1];
+		for (struct header *h = sentinal->next; h != sentinal; h = h->next)
+		{
+			if (get_block_size(h) >= request_size)
+				return h;
+		}
 	}
 
-	// freelist is not empty
-	else
+	return NULL;
+}
+
+/**
+ * @brief inserts a header in the front of its size class's freelist
+ * @param h header to insert
+ */
+static void insert_into_freelist(struct header *h)
+{
+	size_t idx              = get_freelist_index(get_block_size(h));
+	struct header *sentinal = &freelists[idx];
+
+	h->next              = sentinal->next;
+	h->prev              = sentinal;
+	sentinal->next->prev = h;
+	sentinal->next       = h;
+
+	freelist_map[idx / 32] |= 1u << (idx % 32);
+}
+
+/**
+ * @brief unlinks a header from its freelist
+ * @param h header to remove
+ */
+static void remove_from_freelist(struct header *h)
+{
+	h->next->prev = h->prev;
+	h->prev->next = h->next;
+
+	size_t idx = get_freelist_index(get_block_size(h));
+	if (is_freelist_empty(idx))
+		freelist_map[idx / 32] &= ~(1u << (idx % 32));
+}
+
+/**
+ * @brief fills in the kernel heap counters of a meminfo
+ * @param info meminfo to fill in
+ */
+void kmalloc_meminfo(struct meminfo *info)
+{
+	int mask = spin_lock(&kmalloc_lock);
+
+	info->kheap_size = (uintptr_t) top - (uintptr_t) base;
+	for (int i = 0; i < KMALLOC_NCLASSES; i++)
 	{
-		h->next              = sentinal->next;
-		h->prev              = sentinal;
-		sentinal->next->prev = h;
-		sentinal->next       = h;
+		info->kmalloc_bytes[i] = class_bytes[i];
+		info->kmalloc_count[i] = class_count[i];
 	}
+
+	spin_unlock(&kmalloc_lock, mask);
 }
 
 static const char *state_strings[] = {
 	"UNALLOCATED",
 	"ALLOCATED",
 	"SENTINAL",
+	"FENCEPOST",
 };
 
 void print_heap()
@@ -97,7 +391,7 @@ void print_heap()
 	kprintf("\tHEAP: \n");
 	struct header *h = base;
 
-	while ((uintptr_t) h < (uintptr_t) heap)
+	while ((uintptr_t) h < (uintptr_t) top)
 	{
 		kprintf("addr: 0x%x\n", h);
 		kprintf("size: %d (%xh)\n", get_block_size(h), get_block_size(h));
@@ -111,15 +405,17 @@ void print_heap()
 void print_freelist()
 {
 	kprintf("\tFREELIST: \n");
-	struct header *freelist = sentinal;
 
-	do
+	for (int i = 0; i < N_LISTS; i++)
 	{
-		kprintf("addr: 0x%x\n", freelist);
-		kprintf("size: %d (%xh)\n", get_block_size(freelist), get_block_size(freelist));
-		kprintf("prev: 0x%x\n", freelist->prev);
-		kprintf("next: 0x%x\n\n", freelist->next);
-
-		freelist = freelist->next;
-	} while (freelist != sentinal);
+		struct header *sentinal = &freelists[i];
+		for (struct header *h = sentinal->next; h != sentinal; h = h->next)
+		{
+			kprintf("list: %d\n", i);
+			kprintf("addr: 0x%x\n", h);
+			kprintf("size: %d (%xh)\n", get_block_size(h), get_block_size(h));
+			kprintf("prev: 0x%x\n", h->prev);
+			kprintf("next: 0x%x\n\n", h->next);
+		}
+	}
 }
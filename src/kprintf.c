@@ -10,23 +10,31 @@
 #include <kprintf.h>
 
 #include <io.h>
+#include <spinlock.h>
 
 #include <stdio.h>
 
 // COM1 serial port
 #define COM1 0x3f8
 
+// keeps output from different cpus from interleaving mid-line
+static struct spinlock print_lock = SPINLOCK_INIT("print");
+
 static void serial_write(const char *s);
 static void serial_putc(char c);
 
 void kputc(char c)
 {
+	int mask = spin_lock(&print_lock);
 	serial_putc(c);
+	spin_unlock(&print_lock, mask);
 }
 
 void kputs(const char *msg)
 {
+	int mask = spin_lock(&print_lock);
 	serial_write(msg);
+	spin_unlock(&print_lock, mask);
 }
 
 int vkprintf(const char *fmt, ...)
@@ -37,7 +45,10 @@ int vkprintf(const char *fmt, ...)
 	memset(buff, 0, 1024);
 	int ret = vsprintf(buff, fmt, args);
 	va_end(args);
+
+	int mask = spin_lock(&print_lock);
 	serial_write(buff);
+	spin_unlock(&print_lock, mask);
 	return ret;
 }
 
@@ -10,7 +10,12 @@
 #include <pmm.h>
 
 #include <bitmap.h>
+#include <intr.h>
+#include <kmalloc.h>
 #include <kprintf.h>
+#include <meminfo.h>
+#include <spinlock.h>
+#include <vmm.h>
 
 #include <string.h>
 
@@ -30,16 +35,44 @@ static u32 mem_size = 0;
 static u32 used_blocks;
 
 // max number of blocks the system can allocate
-// this should always be equivalent to mem_size / BLOCK_SIZE
+// this is the block just past the end of the highest available region of memory
 static u32 max_blocks;
 
 // bitmap of block allocation status
 // a set bit denotes the block is used
 // the bitmap is placed immediately after the kernel image in memory so we don't have to call kmalloc() to dynamically allocate it
-// the kernel heap will be placed right after the bitmap
+// the buddy allocator's bookkeeping follows it, and the kernel heap will be placed right after that
 // it's like a free call to kmalloc :)
 static u32 *mmap = &end;
 
+/*
+ * buddy allocator state
+ *
+ * free memory is kept as blocks of 2^order contiguous frames, each aligned to its own size.
+ * for every order there is a hierarchical bitmap with one bit per block of that order,
+ * which is set when that block is free. the summary levels of the bitmap mean a free block
+ * of any order is found with a handful of bit scans no matter how large or fragmented memory is,
+ * and a freed block can tell whether its buddy is also free by testing a single bit.
+ * each bitmap's hint makes the search next-fit, so it resumes just past the last block handed out.
+ */
+
+// number of free blocks of each order
+static u32 nr_free[PMM_MAX_ORDER + 1];
+
+// set bit n in free_area[k] denotes the block of order k starting at block n << k is free
+static struct hbitmap free_area[PMM_MAX_ORDER + 1];
+
+// number of references to each block, so a block shared between address spaces
+// is only freed once the last one lets go of it
+static u16 *refcount;
+
+// blocks that have already been allocated and zeroed, ready to be handed out by pmm_alloc_zeroed()
+static uintptr_t zero_pool[ZERO_POOL_SIZE];
+static uint nr_zeroed;
+
+// protects everything above, once the pmm is up
+static struct spinlock pmm_lock = SPINLOCK_INIT("pmm");
+
 // block the kernel starts/ends on
 // i.e. start_block * BLOCK_SIZE = start_phys
 // and    end_block * BLOCK_SIZE = end_phys
@@ -47,6 +80,14 @@ static u32 start_block, end_block;
 
 extern void *heap;
 
+static void freelist_add(uint, u32);
+static void freelist_remove(uint, u32);
+static inline u32 bitmap_size(u32);
+static void set_range(u32, u32);
+static void clear_range(u32, u32);
+static bool range_is_set(u32, u32);
+static bool range_is_clear(u32, u32);
+
 void pmm_init()
 {
 	// print out the physical memory map
@@ -107,6 +148,9 @@ void pmm_init()
 
 		mem_size += ent->len;
 
+		if (ent->type == MMAP_MEMORY_AVAILABLE && (base + len) / BLOCK_SIZE > max_blocks)
+			max_blocks = (base + len) / BLOCK_SIZE;
+
 		kprintf("0x%8x-0x%8x: | 0x%8x | %s (%d)\n", base, base + len - 1, len, typestr, ent->type);
 		ent++;
 	}
@@ -122,11 +166,34 @@ void pmm_init()
 	start_block = (u32) &start_phys / BLOCK_SIZE;
 	end_block   = (u32) &end_phys   / BLOCK_SIZE;
 
-	// the number of bytes mmap bitmap takes up is conveniently exactly equal to max_blocks
-	max_blocks = mem_size / BLOCK_SIZE;
+	// the bookkeeping and the kernel heap have to fit in the first 4M the bootloader mapped,
+	// since nothing else is mapped until vmm_init() builds the direct map
+	u32 meta_size = bitmap_size(max_blocks) + max_blocks * sizeof(u16);
+	for (int order = 0; order <= PMM_MAX_ORDER; order++)
+		meta_size += hbitmap_size((max_blocks >> order) + 1);
+
+	if ((uptr) mmap + BLOCK_ALIGN(meta_size) + KHEAP_SIZE > KERNEL_BASE + LARGE_PAGE_SIZE)
+	{
+		kprintf("pmm_init: bookkeeping for %d blocks doesn't fit in the boot mapping!\n", max_blocks);
+		while (1)
+			;
+	}
+
+	// lay out the bookkeeping structures back to back after the kernel image
+	u8 *meta = (u8 *) mmap + bitmap_size(max_blocks);
+	for (int order = 0; order <= PMM_MAX_ORDER; order++)
+	{
+		u32 nbits = (max_blocks >> order) + 1;
+		hbitmap_init(&free_area[order], meta, nbits);
+		meta += hbitmap_size(nbits);
+	}
+
+	refcount = (u16 *) meta;
+	memset(refcount, 0, max_blocks * sizeof(u16));
+	meta += max_blocks * sizeof(u16);
 
 	// mark every block as reserved
-	memset(mmap, 0xff, max_blocks);
+	memset(mmap, 0xff, bitmap_size(max_blocks));
 
 	// loop back through the memory map and mark available blocks as available
 	ent = (struct mmap_entry *) MMAP_BASE;
@@ -146,31 +213,59 @@ void pmm_init()
 		ent++;
 	}
 
+	// the first blocks of memory hold the real mode ivt, bios data, and the bootloader's structures.
+	// keeping them reserved also means a valid block is never at physical address 0
+	for (size_t i = 0; i < LOW_RESERVED / BLOCK_SIZE; i++)
+		BITMAP_SET(mmap, i);
+
 	// after this, the kernel's blocks will be marked as clear, so we have to re-reserve them
 	// calculate kernel size in blocks
 	u32 kernel_blocks = (u32) &size / BLOCK_SIZE;
 	for (size_t i = 0; i < kernel_blocks; i++)
 		BITMAP_SET(mmap, start_block + i);
-	
-	// same with mmap
-	// how many blocks the mmap itself takes up
-	u32 mmap_blocks = BLOCK_ALIGN(max_blocks) / BLOCK_SIZE;
+
+	// same with mmap and the rest of the bookkeeping
+	// how many blocks they take up
+	u32 mmap_blocks = BLOCK_ALIGN((uptr) meta - (uptr) mmap) / BLOCK_SIZE;
 	for (size_t i = 0; i < mmap_blocks; i++)
 		BITMAP_SET(mmap, end_block + i);
 
 	// kernel heap can begin immediately after mmap (on a block-aligned boundary)
 	heap = (void *) ((u8 *) mmap + mmap_blocks * BLOCK_SIZE);
 
-	// finally, print out calculated memory stats
-	int free_blocks = 0;
-	for (size_t block = 0; block < max_blocks; block++)
+	// and the heap's blocks must be reserved too, or pmm_alloc() would hand them out from under kmalloc
+	u32 heap_blocks = KHEAP_SIZE / BLOCK_SIZE;
+	for (size_t i = 0; i < heap_blocks; i++)
+		BITMAP_SET(mmap, end_block + mmap_blocks + i);
+
+	// hand every run of free blocks to the buddy allocator as the largest aligned blocks that fit
+	for (int order = 0; order <= PMM_MAX_ORDER; order++)
+		nr_free[order] = 0;
+
+	u32 free_blocks = 0;
+	u32 block       = 0;
+	while (block < max_blocks)
 	{
-		if (!BITMAP_TEST(mmap, block))
-			free_blocks++;
-        else
-            used_blocks++;
+		if (BITMAP_TEST(mmap, block))
+		{
+			block++;
+			continue;
+		}
+
+		u32 order = 0;
+		while (order < PMM_MAX_ORDER
+		       && block % (2 << order) == 0
+		       && block + (2 << order) <= max_blocks
+		       && range_is_clear(block, 2 << order))
+			order++;
+
+		freelist_add(order, block);
+		free_blocks += 1 << order;
+		block       += 1 << order;
 	}
 
+	used_blocks = max_blocks - free_blocks;
+
 	kprintf("Installed memory: %d bytes (%d blocks)\n", max_blocks * BLOCK_SIZE, max_blocks);
 	kprintf("Free memory: %d bytes (%d blocks)\n", free_blocks * BLOCK_SIZE, free_blocks);
 }
@@ -181,14 +276,349 @@ void pmm_init()
  */
 uintptr_t pmm_alloc()
 {
-	int idx = BITMAP_FIRST_CLEAR(mmap, max_blocks);
+	return pmm_alloc_order(0);
+}
 
-	if (idx < 0)
+/**
+ * @brief allocate 2^order physically contiguous blocks of memory
+ * @param order log2 of the number of blocks to allocate
+ * @return physical address of the first allocated block, aligned to 2^order blocks
+ */
+uintptr_t pmm_alloc_order(uint order)
+{
+	if (order > PMM_MAX_ORDER)
 	{
+		kprintf("pmm_alloc_order: order %d is too large!\n", order);
+		return (uintptr_t) -1;
+	}
+
+	int mask = spin_lock(&pmm_lock);
+
+	// find the smallest free block that is large enough
+	uint k = order;
+	while (k <= PMM_MAX_ORDER && nr_free[k] == 0)
+		k++;
+
+	// rather than fail, dip into the zero pool
+	if (k > PMM_MAX_ORDER && order == 0 && nr_zeroed > 0)
+	{
+		uintptr_t phys = zero_pool[--nr_zeroed];
+		spin_unlock(&pmm_lock, mask);
+		return phys;
+	}
+
+	if (k > PMM_MAX_ORDER)
+	{
+		spin_unlock(&pmm_lock, mask);
 		kprintf("pmm_alloc: out of physical memory!\n");
 		return (uintptr_t) -1;
 	}
 
-	BITMAP_SET(mmap, idx);
-	return idx * BLOCK_SIZE;
+	u32 idx   = hbitmap_find(&free_area[k]);
+	u32 block = idx << k;
+	freelist_remove(k, block);
+	free_area[k].hint = idx + 1;
+
+	// split it in half until it is the right size, freeing the upper halves
+	while (k > order)
+	{
+		k--;
+		freelist_add(k, block + (1 << k));
+	}
+
+	set_range(block, 1 << order);
+	used_blocks += 1 << order;
+	refcount[block] = 1;
+
+	spin_unlock(&pmm_lock, mask);
+	return block * BLOCK_SIZE;
+}
+
+/**
+ * @brief allocate a block of physical memory that is filled with zeroes
+ * the block comes from the pool the idle process keeps filled when it can,
+ * so the caller doesn't have to spend time zeroing it
+ * @return physical address of allocated block
+ */
+uintptr_t pmm_alloc_zeroed()
+{
+	int mask = spin_lock(&pmm_lock);
+	if (nr_zeroed > 0)
+	{
+		uintptr_t phys = zero_pool[--nr_zeroed];
+		spin_unlock(&pmm_lock, mask);
+		return phys;
+	}
+
+	spin_unlock(&pmm_lock, mask);
+
+	// the pool ran dry, so zero one here
+	uintptr_t phys = pmm_alloc();
+	if (phys == (uintptr_t) -1)
+		return phys;
+
+	void *page = vmm_kmap(phys);
+	memset(page, 0, BLOCK_SIZE);
+	vmm_kunmap(page);
+	return phys;
+}
+
+/**
+ * @brief zeroes a free block and adds it to the zero pool, if the pool isn't full.
+ * called from the idle loop, so blocks are zeroed when the cpu has nothing better to do
+ * @return true if the pool still has room after this call
+ */
+bool pmm_refill_zero_pool()
+{
+	if (nr_zeroed >= ZERO_POOL_SIZE)
+		return false;
+
+	// leave the last few free blocks for real allocations
+	if (max_blocks - used_blocks <= ZERO_POOL_SIZE)
+		return false;
+
+	uintptr_t phys = pmm_alloc();
+	if (phys == (uintptr_t) -1)
+		return false;
+
+	// zero with interrupts on, so anything that becomes ready can preempt the idle process
+	void *page = vmm_kmap(phys);
+	memset(page, 0, BLOCK_SIZE);
+	vmm_kunmap(page);
+
+	int mask = spin_lock(&pmm_lock);
+	bool added = nr_zeroed < ZERO_POOL_SIZE;
+	if (added)
+		zero_pool[nr_zeroed++] = phys;
+
+	spin_unlock(&pmm_lock, mask);
+
+	if (!added)
+		pmm_free(phys);
+
+	return added && nr_zeroed < ZERO_POOL_SIZE;
+}
+
+/**
+ * @brief free a single block of physical memory
+ * @param phys physical address of the block, as returned by pmm_alloc()
+ */
+void pmm_free(uintptr_t phys)
+{
+	pmm_free_order(phys, 0);
+}
+
+/**
+ * @brief free 2^order physically contiguous blocks of memory
+ * if the blocks have other references (see pmm_ref()), this only drops one of them
+ * @param phys physical address of the first block, as returned by pmm_alloc_order()
+ * @param order order the blocks were allocated with
+ */
+void pmm_free_order(uintptr_t phys, uint order)
+{
+	u32 block = phys / BLOCK_SIZE;
+
+	if (order > PMM_MAX_ORDER || phys % (BLOCK_SIZE << order) != 0 || block + (1 << order) > max_blocks)
+	{
+		kprintf("pmm_free: bad block 0x%x (order %d)!\n", phys, order);
+		return;
+	}
+
+	int mask = spin_lock(&pmm_lock);
+
+	if (!range_is_set(block, 1 << order))
+	{
+		spin_unlock(&pmm_lock, mask);
+		kprintf("pmm_free: 0x%x (order %d) is not allocated!\n", phys, order);
+		return;
+	}
+
+	// someone else still uses the blocks
+	if (refcount[block] > 1)
+	{
+		refcount[block]--;
+		spin_unlock(&pmm_lock, mask);
+		return;
+	}
+
+	refcount[block] = 0;
+
+	clear_range(block, 1 << order);
+	used_blocks -= 1 << order;
+
+	// merge with the buddy for as long as the buddy is also free
+	while (order < PMM_MAX_ORDER)
+	{
+		u32 buddy = block ^ (1 << order);
+		if (buddy + (1 << order) > max_blocks || !hbitmap_test(&free_area[order], buddy >> order))
+			break;
+
+		freelist_remove(order, buddy);
+		block &= ~(1 << order);
+		order++;
+	}
+
+	freelist_add(order, block);
+	spin_unlock(&pmm_lock, mask);
+}
+
+/**
+ * @brief end of physical memory
+ * @return physical address just past the highest available block
+ */
+uintptr_t pmm_mem_end()
+{
+	return max_blocks * BLOCK_SIZE;
+}
+
+/**
+ * @brief adds a reference to an allocated block, so it takes one more pmm_free() to free it
+ * @param phys physical address of the block
+ */
+void pmm_ref(uintptr_t phys)
+{
+	u32 block = phys / BLOCK_SIZE;
+
+	int mask = spin_lock(&pmm_lock);
+	if (block < max_blocks && BITMAP_TEST(mmap, block))
+		refcount[block]++;
+	else
+		kprintf("pmm_ref: 0x%x is not allocated!\n", phys);
+
+	spin_unlock(&pmm_lock, mask);
+}
+
+/**
+ * @brief number of references to a block
+ * @param phys physical address of the block
+ * @return number of references, or 0 if the block is free
+ */
+uint pmm_refcount(uintptr_t phys)
+{
+	u32 block = phys / BLOCK_SIZE;
+	return block < max_blocks ? refcount[block] : 0;
+}
+
+/**
+ * @brief fills in the physical memory counters of a meminfo
+ * @param info meminfo to fill in
+ */
+void pmm_meminfo(struct meminfo *info)
+{
+	int mask = spin_lock(&pmm_lock);
+
+	// blocks in the zero pool are allocated as far as the buddy allocator is concerned,
+	// but they are just as available as any other free block
+	info->total_frames  = max_blocks;
+	info->used_frames   = used_blocks - nr_zeroed;
+	info->free_frames   = max_blocks - info->used_frames;
+	info->zeroed_frames = nr_zeroed;
+
+	spin_unlock(&pmm_lock, mask);
+}
+
+/**
+ * @brief marks a block free at its order
+ * @param order order of the block
+ * @param block index of the first block
+ */
+static void freelist_add(uint order, u32 block)
+{
+	hbitmap_set(&free_area[order], block >> order);
+	nr_free[order]++;
+}
+
+/**
+ * @brief marks a block no longer free at its order
+ * @param order order of the block
+ * @param block index of the first block
+ */
+static void freelist_remove(uint order, u32 block)
+{
+	hbitmap_clear(&free_area[order], block >> order);
+	nr_free[order]--;
+}
+
+/**
+ * @brief number of bytes needed for a bitmap, rounded up to whole words
+ * @param bits number of bits in the bitmap
+ */
+static inline u32 bitmap_size(u32 bits)
+{
+	return (bits + 31) / 32 * sizeof(u32);
+}
+
+// marks count blocks starting at block as used, a word at a time where possible
+static void set_range(u32 block, u32 count)
+{
+	while (count && block % 32)
+	{
+		BITMAP_SET(mmap, block++);
+		count--;
+	}
+
+	for (; count >= 32; count -= 32, block += 32)
+		mmap[block / 32] = 0xffffffff;
+
+	while (count--)
+		BITMAP_SET(mmap, block++);
+}
+
+// marks count blocks starting at block as free, a word at a time where possible
+static void clear_range(u32 block, u32 count)
+{
+	while (count && block % 32)
+	{
+		BITMAP_CLEAR(mmap, block++);
+		count--;
+	}
+
+	for (; count >= 32; count -= 32, block += 32)
+		mmap[block / 32] = 0;
+
+	while (count--)
+		BITMAP_CLEAR(mmap, block++);
+}
+
+// true if every one of count blocks starting at block is in the given state, whole words are compared at once
+static bool range_is(u32 block, u32 count, bool used)
+{
+	u32 word = used ? 0xffffffff : 0;
+
+	while (count && block % 32)
+	{
+		if (BITMAP_TEST(mmap, block) != used)
+			return false;
+
+		block++;
+		count--;
+	}
+
+	for (; count >= 32; count -= 32, block += 32)
+	{
+		if (mmap[block / 32] != word)
+			return false;
+	}
+
+	while (count--)
+	{
+		if (BITMAP_TEST(mmap, block) != used)
+			return false;
+
+		block++;
+	}
+
+	return true;
+}
+
+// true if every one of count blocks starting at block is used
+static bool range_is_set(u32 block, u32 count)
+{
+	return range_is(block, count, true);
+}
+
+// true if every one of count blocks starting at block is free
+static bool range_is_clear(u32 block, u32 count)
+{
+	return range_is(block, count, false);
 }
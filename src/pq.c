@@ -1,4 +1,3 @@
-
 /* maestro
  * License: GPLv2
  * See LICENSE.txt for full license text
@@ -11,60 +10,137 @@
 
 #include <pq.h>
 
-#include <kmalloc.h>
+#include <kprintf.h>
+
+/**
+ * @brief compares keys in a way that survives them wrapping around
+ * keys are usually timestamps, so a key just past the wrap still sorts after one just before it
+ * @return true if key a comes before key b
+ */
+static inline bool before(u32 a, u32 b)
+{
+	return (s32) (a - b) < 0;
+}
 
-static inline bool is_empty(struct pq **head)
+static inline void place(struct pq *pq, struct pqnode *node, uint i)
 {
-	return (*head) == NULL;
+	pq->heap[i] = node;
+	node->index = i;
 }
 
-void push(struct pq **head, void *data, int (*cmp)(void *a, void *b))
+// moves the node at i up towards the root until its parent comes before it
+static void sift_up(struct pq *pq, uint i)
 {
-	// node to insert
-	struct pq *ins = newpq();
-	ins->data = data;
+	struct pqnode *node = pq->heap[i];
 
-	if (is_empty(head))
+	while (i > 0)
 	{
-		*head = ins;
-		return;
+		uint parent = (i - 1) / 2;
+		if (!before(node->key, pq->heap[parent]->key))
+			break;
+
+		place(pq, pq->heap[parent], i);
+		i = parent;
 	}
 
-	// special case - ins belongs at head of list
-	if (cmp((*head)->data, ins->data) > 0)
+	place(pq, node, i);
+}
+
+// moves the node at i down towards the leaves until it comes before both of its children
+static void sift_down(struct pq *pq, uint i)
+{
+	struct pqnode *node = pq->heap[i];
+
+	while (2 * i + 1 < pq->count)
 	{
-		ins->next = *head;
-		*head = ins;
-		return;
+		uint child = 2 * i + 1;
+		if (child + 1 < pq->count && before(pq->heap[child + 1]->key, pq->heap[child]->key))
+			child++;
+
+		if (!before(pq->heap[child]->key, node->key))
+			break;
+
+		place(pq, pq->heap[child], i);
+		i = child;
 	}
 
-	struct pq *tmp = *head;
-	while (tmp->next && (cmp(tmp->next->data, data) <= 0))
-		tmp = tmp->next;
+	place(pq, node, i);
+}
 
-	ins->next = tmp->next;
-	tmp->next = ins;
+/**
+ * @brief initializes an empty priority queue
+ * @param pq queue to initialize
+ * @param heap array of capacity pointers the queue keeps its nodes in
+ * @param capacity most nodes the queue can hold at once
+ */
+void pq_init(struct pq *pq, struct pqnode **heap, uint capacity)
+{
+	pq->heap     = heap;
+	pq->count    = 0;
+	pq->capacity = capacity;
 }
 
-struct pq *pop(struct pq **head)
+/**
+ * @brief adds a node to a priority queue
+ * @param pq queue to add to
+ * @param node node to add, with its key already set
+ * @return true on success, or false if the queue is full
+ */
+bool push(struct pq *pq, struct pqnode *node)
 {
-	struct pq *tmp = *head;
-	*head = tmp->next;
-	return tmp;
+	if (pq->count == pq->capacity)
+	{
+		kprintf("push: priority queue is full!\n");
+		return false;
+	}
+
+	pq->heap[pq->count] = node;
+	sift_up(pq, pq->count++);
+	return true;
 }
 
-void *peek(struct pq **head)
+/**
+ * @brief the node with the smallest key, without removing it
+ * @param pq queue to look in
+ * @return the front node, or NULL if the queue is empty
+ */
+struct pqnode *peek(struct pq *pq)
 {
-	if (is_empty(head))
-		return NULL;
+	return pq->count ? pq->heap[0] : NULL;
+}
 
-	return (*head)->data;
+/**
+ * @brief removes the node with the smallest key
+ * @param pq queue to remove from
+ * @return the removed node, or NULL if the queue is empty
+ */
+struct pqnode *pop(struct pq *pq)
+{
+	struct pqnode *node = peek(pq);
+	if (node)
+		pq_remove(pq, node);
+
+	return node;
 }
 
-struct pq *newpq()
+/**
+ * @brief removes any node from a priority queue
+ * @param pq queue the node is in
+ * @param node node to remove
+ */
+void pq_remove(struct pq *pq, struct pqnode *node)
 {
-	struct pq *pq = (struct pq *) kmalloc(sizeof(struct pq));
-	pq->next = NULL;
-	pq->data = NULL;
-	return pq;
+	uint i = node->index;
+
+	// fill the hole with the last node, which then has to be moved to wherever it belongs
+	struct pqnode *last = pq->heap[--pq->count];
+	if (last == node)
+		return;
+
+	place(pq, last, i);
+
+	if (i > 0 && before(last->key, pq->heap[(i - 1) / 2]->key))
+		sift_up(pq, i);
+	else
+		sift_down(pq, i);
 }
@@ -8,10 +8,13 @@
  * DESCRIPTION: process management
  */
 #include <proc.h>
+#include <fpu.h>
 #include <kmalloc.h>
 #include <kprintf.h>
 #include <pq.h>
 #include <queue.h>
+#include <slab.h>
+#include <vmm.h>
 
 #include <string.h>
 
@@ -21,65 +24,178 @@ extern u32 isr_end;
 // defined in elf.c
 extern void run_elf();
 
-struct proc *curr;
 struct proc *proctab[NPROC];
 
-// process ready queue
-struct queue *readyq;
+struct spinlock sched_lock = SPINLOCK_INIT("sched");
 
-// process sleep queue
-struct pq *sleepq;
+// run queue of each cpu
+struct runq runqs[NCPU];
 
-const struct proc nullproc = {
-	.state = PR_RUNNING,
-	.stkptr = 0,
-	.pid = -1,
-	.mask = 0,
-	.wakeup = 0,
-	.name = "null process",
-};
+// process sleep queue, and the heap backing it. every process sleeps at most once at a time
+struct pq sleepq;
+static struct pqnode *sleepheap[NPROC];
+
+// cache of process structures
+static struct kmem_cache *proc_cache;
 
 // number of active processes
 int nproc = 0;
 
 int next_pid = 0;
 
+// removes a process from the process table
+static void unlist(struct proc *pptr)
+{
+	int mask = spin_lock(&sched_lock);
+	for (int i = 0; i < NPROC; i++)
+	{
+		if (proctab[i] == pptr)
+			proctab[i] = NULL;
+	}
+
+	spin_unlock(&sched_lock, mask);
+}
+
 void proc_init()
 {
-	readyq = newq();
-	sleepq = newpq();
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc), NULL);
+	for (int i = 0; i < NCPU; i++)
+	{
+		for (int j = 0; j < NPRIO; j++)
+			queue_init(&runqs[i].level[j]);
+
+		runqs[i].nready = 0;
+	}
+
+	pq_init(&sleepq, sleepheap, NPROC);
 }
 
 /**
- * @brief adds a process to the ready queue
+ * @brief adds a process to the ready queue of its priority level, on the cpu it last ran on
+ * a process that hasn't run yet goes to the least loaded cpu
  * @param pptr process pointer to ready
  */
 void ready(struct proc *pptr)
 {
+	int mask = spin_lock(&sched_lock);
+	if (pptr->cpu < 0)
+		pptr->cpu = least_loaded_cpu();
+
 	pptr->state = PR_READY;
-	insert(readyq, pptr);
+	insert(&runqs[pptr->cpu].level[pptr->prio], &pptr->qlink);
+	runqs[pptr->cpu].nready++;
+
+	// an idle cpu only looks at its run queue once a ms, so tell it right away
+	struct cpu *cpu = &cpus[pptr->cpu];
+	if (cpu->id != cpu_id() && cpu->proc == cpu->idle)
+		smp_resched(cpu);
+
+	spin_unlock(&sched_lock, mask);
 }
 
+// undoes create() for a process that never ran
+static void discard(struct proc *pptr)
+{
+	vmm_destroy_address_space(pptr);
+	int mask = spin_lock(&sched_lock);
+	unlist(pptr);
+	nproc--;
+	spin_unlock(&sched_lock, mask);
+
+	kmem_cache_free(proc_cache, pptr);
+}
+
+/**
+ * @brief creates a new user process in its own address space
+ * @param path path of the elf file the process will run
+ * @return the new process, or NULL if the process table is full or it couldn't be given an address space
+ */
 struct proc *create_usermode(const char *path)
 {
-    return create(run_elf, path);
+    struct proc *pptr = create(run_elf, path);
+    if (!pptr)
+        return NULL;
+
+    uintptr_t pdir = vmm_create_address_space();
+    if (!pdir)
+    {
+        discard(pptr);
+        return NULL;
+    }
+
+    pptr->pdir = pdir;
+    return pptr;
 }
 
 /**
- * @brief creates a new process in the suspended state 
- * @param f function where the new process will begin execution
+ * @brief allocates and initializes a process, everything but the stack frame it starts from
  * @param name name of the new process
  */
-struct proc *create(void (*f)(void), const char *name)
+static struct proc *proc_alloc(const char *name)
 {
-	struct proc *pptr = (struct proc *) kmalloc(sizeof(struct proc));
+	struct proc *pptr = (struct proc *) kmem_cache_alloc(proc_cache);
 	strncpy(pptr->name, name, 32);
 	pptr->mask = 0;
 	pptr->state = PR_SUSPENDED;
+	pptr->prio = 0;
+	pptr->nice = 0;
+	pptr->ticks = 0;
+	pptr->slice = 0;
+	pptr->cputime = 0;
+	pptr->dispatched = 0;
+	pptr->cpu = -1;
+	pptr->status = 0;
+	pptr->joiner = NULL;
+	pptr->joinable = false;
+	pptr->fpu = NULL;
+	pptr->fpu_cpu = -1;
+	pptr->regions = NULL;
+	pptr->brk_start = 0;
+	pptr->brk = 0;
+
+	// kernel processes have no user memory of their own, so they can all share the kernel's address space
+	pptr->pdir = vmm_kernel_address_space();
+
+	// objects are recycled by the proc cache, so don't inherit a dead process's open files
+	memset(pptr->ofile, 0, sizeof(pptr->ofile));
 	
-	u32 *kstack = (u32 *) (pptr->kstack + PR_STACKSIZE);
-	pptr->stkbtm = (uintptr_t) kstack;
+	pptr->stkbtm = (uintptr_t) (pptr->kstack + PR_STACKSIZE);
+	return pptr;
+}
 
+// gives a process its pid and adds it to the process table, false if the table is full
+static bool proc_register(struct proc *pptr)
+{
+	int mask = spin_lock(&sched_lock);
+	for (int i = 0; i < NPROC; i++)
+	{
+		if (!proctab[i])
+		{
+			pptr->pid  = next_pid++;
+			proctab[i] = pptr;
+			nproc++;
+			spin_unlock(&sched_lock, mask);
+			return true;
+		}
+	}
+
+	spin_unlock(&sched_lock, mask);
+	kprintf("proc_register: process table is full!\n");
+	return false;
+}
+
+/**
+ * @brief creates a new process in the suspended state 
+ * f starts out in the kernel, and has to go on to user mode with the interrupt frame below it.
+ * a thread that stays in the kernel is made with kthread_create() instead
+ * @param f function where the new process will begin execution
+ * @param name name of the new process
+ * @return the new process, or NULL if the process table is full
+ */
+struct proc *create(void (*f)(void), const char *name)
+{
+	struct proc *pptr = proc_alloc(name);
+	u32 *kstack       = (u32 *) pptr->stkbtm;
 
 	/**
 	 * create a dummy kernel stack frame that ctxsw can return from
@@ -105,6 +221,10 @@ struct proc *create(void (*f)(void), const char *name)
 	 * general purpose regs
 	 * struct registers *
 	 * 
+	 * [return addresses]
+	 * f
+	 * proc_entry [2]
+	 * 
 	 * [pushed by ctxsw]
 	 * ebp
 	 * ebx
@@ -113,6 +233,7 @@ struct proc *create(void (*f)(void), const char *name)
 	 * 
 	 * [0] - esp at time of interrupt (that is, the user esp)
 	 * [1] - eip for interrupt to return to (that is, the process's main())
+	 * [2] - ctxsw returns here first, to release the lock sched() switched to the process with
 	 */
 	kstack--; *kstack = 0x23;            // ss
 	kstack--; *kstack = 0;               // esp
@@ -137,7 +258,8 @@ struct proc *create(void (*f)(void), const char *name)
 	kstack--; *kstack = 0;
 
 	kstack--;                            // struct registers *
-	kstack--; *kstack = (u32) f;         // ctxsw return address
+	kstack--; *kstack = (u32) f;         // proc_entry return address
+	kstack--; *kstack = (u32) proc_entry; // ctxsw return address
 
 	kstack--; *kstack = 0;               // ebp
 	kstack--; *kstack = 0;               // ebx
@@ -145,18 +267,225 @@ struct proc *create(void (*f)(void), const char *name)
 	kstack--; *kstack = 0;               // edi
 
 	pptr->stkptr = (uintptr_t) kstack;
-	pptr->pid = next_pid++;
+	if (!proc_register(pptr))
+	{
+		kmem_cache_free(proc_cache, pptr);
+		return NULL;
+	}
+
+	return pptr;
+}
+
+/**
+ * @brief where every kernel thread starts, once proc_entry() returns into it
+ * @param fn function the thread runs
+ * @param arg argument to pass to fn
+ */
+static void kthread_entry(int (*fn)(void *), void *arg)
+{
+	asm("sti");
+	kthread_exit(fn(arg));
+}
+
+/**
+ * @brief creates a thread that runs in the kernel, and readies it
+ * a kernel thread runs in ring 0 on its own kernel stack, in the kernel's address space,
+ * and is scheduled just like any other process. returning from fn exits the thread
+ * @param fn function the thread runs
+ * @param arg argument to pass to fn
+ * @param name name of the thread
+ * @return the new thread, or NULL if the process table is full
+ */
+struct proc *kthread_create(int (*fn)(void *), void *arg, const char *name)
+{
+	struct proc *pptr = proc_alloc(name);
+	u32 *kstack       = (u32 *) pptr->stkbtm;
 
-	nproc++;
+	// ctxsw returns into proc_entry, which returns into kthread_entry(fn, arg).
+	// there is no interrupt frame under it, since the thread never goes to user mode
+	kstack--; *kstack = (u32) arg;
+	kstack--; *kstack = (u32) fn;
+	kstack--; *kstack = 0;                    // kthread_entry return address, never used
+	kstack--; *kstack = (u32) kthread_entry;  // proc_entry return address
+	kstack--; *kstack = (u32) proc_entry;     // ctxsw return address
+
+	kstack--; *kstack = 0;                    // ebp
+	kstack--; *kstack = 0;                    // ebx
+	kstack--; *kstack = 0;                    // esi
+	kstack--; *kstack = 0;                    // edi
+
+	pptr->stkptr   = (uintptr_t) kstack;
+	pptr->joinable = true;
+	if (!proc_register(pptr))
+	{
+		kmem_cache_free(proc_cache, pptr);
+		return NULL;
+	}
+
+	ready(pptr);
 	return pptr;
 }
 
+/**
+ * @brief waits for a kernel thread to exit, then frees it
+ * only one process may join a thread, and the thread can't be used once it has been joined.
+ * a thread that exits is only freed once it has been joined
+ * @param pptr thread to wait for
+ * @return the thread's exit status
+ */
+int kthread_join(struct proc *pptr)
+{
+	int mask = spin_lock(&sched_lock);
+	while (pptr->state != PR_TERMINATED)
+	{
+		pptr->joiner = this_cpu()->proc;
+		pptr->joiner->state = PR_WAITING;
+		sched();
+	}
+
+	// the thread switched away for the last time before the lock was released, so nothing uses its stack anymore
+	int status = pptr->status;
+	kmem_cache_free(proc_cache, pptr);
+	spin_unlock(&sched_lock, mask);
+	return status;
+}
+
+/**
+ * @brief returns the memory of a process that has exited to the proc cache
+ * @param pptr process to free, which must not be running anywhere
+ */
+void proc_free(struct proc *pptr)
+{
+	kmem_cache_free(proc_cache, pptr);
+}
+
+/**
+ * @brief exits the kernel thread making the call, waking up the process joining it
+ * @param status exit status to pass to kthread_join()
+ */
+void kthread_exit(int status)
+{
+	proc_exit(status);
+}
+
+/**
+ * @brief creates a copy of the current process, which resumes in user mode
+ * from the same system call as the current process, but returning 0
+ * @param regs registers saved by the current process's system call
+ * @return the new process, in the suspended state, or NULL if out of memory or the process table is full
+ */
+struct proc *fork(struct registers *regs)
+{
+	// the child's stack frame starts out as a copy of the parent's, and ctxsw returns
+	// straight into the tail of the interrupt handler, which irets to user mode with it
+	struct proc *pptr = create((void (*)(void)) &isr_end, curr->name);
+	if (!pptr)
+		return NULL;
+
+	if (vmm_clone_address_space(curr, pptr) != 0)
+	{
+		discard(pptr);
+		return NULL;
+	}
+
+	// registers pushed by the interrupt, followed by cs, eflags, esp, and ss pushed by the cpu
+	size_t frame_size = sizeof(struct registers) + 4 * sizeof(u32);
+	struct registers *child_regs = (struct registers *) (pptr->stkbtm - frame_size);
+	memcpy(child_regs, regs, frame_size);
+	child_regs->eax = 0;
+
+	vfs_fork(curr, pptr);
+	pptr->brk_start = curr->brk_start;
+	pptr->brk       = curr->brk;
+
+	// the child starts out where the parent is, so forking can't be used to climb levels
+	pptr->nice = curr->nice;
+	pptr->prio = curr->prio;
+
+	fpu_fork(curr, pptr);
+	return pptr;
+}
+
+/**
+ * @brief finds a live process by its pid
+ * the process may exit and be freed as soon as sched_lock is released, so a caller that
+ * goes on to use it has to hold sched_lock across the lookup and the use
+ * @param pid pid of the process
+ * @return the process, or NULL if no process has that pid
+ */
+struct proc *find_proc(int pid)
+{
+	int mask = spin_lock(&sched_lock);
+	struct proc *pptr = NULL;
+	for (int i = 0; i < NPROC; i++)
+	{
+		if (proctab[i] && proctab[i]->pid == pid)
+		{
+			pptr = proctab[i];
+			break;
+		}
+	}
+
+	spin_unlock(&sched_lock, mask);
+	return pptr;
+}
+
+/**
+ * @brief changes the base priority level of a process
+ * @param pptr process to change
+ * @param inc amount to add to the process's base level, where a larger level is a lower priority
+ * @return the new base level, clamped to between 0 and NPRIO - 1
+ */
+int proc_nice(struct proc *pptr, int inc)
+{
+	int mask = spin_lock(&sched_lock);
+
+	int nice = pptr->nice + inc;
+	if (nice < 0)
+		nice = 0;
+	if (nice > NPRIO - 1)
+		nice = NPRIO - 1;
+
+	pptr->nice = nice;
+
+	if (pptr->prio < nice)
+	{
+		// a ready process has to move to the queue of its new level
+		if (pptr->state == PR_READY)
+		{
+			struct runq *rq = &runqs[pptr->cpu];
+			queue_remove(&rq->level[pptr->prio], &pptr->qlink);
+			pptr->prio = nice;
+			insert(&rq->level[pptr->prio], &pptr->qlink);
+		}
+
+		else
+			pptr->prio = nice;
+	}
+
+	spin_unlock(&sched_lock, mask);
+	return nice;
+}
+
 void proc_exit(int status)
 {
-    kprintf("%s (pid = %d) exited with code %d\n", curr->name, curr->pid, status);
-    // TODO - unmap and free all memory used by the process
-    curr->state = PR_TERMINATED;
+    struct proc *pptr = curr;
+    kprintf("%s (pid = %d) exited with code %d\n", pptr->name, pptr->pid, status);
+    vfs_exit(pptr);
+
+    // the address space is torn down under the lock, so vmm_resident_pages()
+    // on another cpu never walks page tables as they are freed.
+    // sched() never returns here, and the process switched to releases the lock
+    spin_lock(&sched_lock);
+    vmm_destroy_address_space(pptr);
+    fpu_exit(pptr);
+    unlist(pptr);
+    pptr->state  = PR_TERMINATED;
+    pptr->status = status;
     nproc--;
 
+    if (pptr->joiner)
+        ready(pptr->joiner);
+
     sched();
 }
@@ -6,52 +6,353 @@
  * FILE: sched.c
  * DATE: August 9, 2021
  * DESCRIPTION: pick the next eligible process to run
+ *
+ * Ready processes wait in a multi-level feedback queue. The scheduler always runs a process
+ * from the highest non-empty level, round robin within that level. A process that uses up
+ * its allotment of cpu time at one level is demoted to the level below, and a process that
+ * blocks before then moves up a level, so cpu bound processes sink and interactive ones float.
+ * Every MLFQ_BOOST_MS, every process is moved back up to its base level so none of them starve.
+ *
+ * A process runs for at most one time slice before the clock preempts it, and the length of
+ * a slice depends on the level it runs at. A process is also preempted as soon as one from a
+ * higher level becomes ready, so the worst case latency to get the cpu is one slice.
+ *
+ * Every cpu schedules from its own run queue, and a process that is readied goes back to the
+ * cpu it last ran on, whose caches are still warm with its memory. A process that hasn't run yet
+ * goes to the least loaded cpu. A cpu about to go idle steals a process from the busiest cpu, and
+ * every BALANCE_MS a cpu pulls one over if the busiest cpu has at least two more than it does.
+ *
+ * The run queues are all protected by sched_lock. The lock is held across the switch,
+ * so no other cpu can pick up the old process until its registers are saved.
  */
 
+#include <clk.h>
+#include <fpu.h>
 #include <intr.h>
 #include <kprintf.h>
 #include <proc.h>
 #include <queue.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <syscall.h>
 
 extern struct proc *proctab[];
-extern struct proc *curr;
-extern struct proc nullproc;
 extern int nproc;
-extern struct queue *readyq;
+
+// time each cpu last balanced its load against the busiest cpu
+static u32 balanced[NCPU];
+
+// length in ms of a time slice at each priority level. the lower levels hold cpu bound
+// processes, which get longer slices so they are switched away from less often
+u32 sched_quantum[NPRIO] = {
+	QUANTUM_MS,
+	QUANTUM_MS,
+	QUANTUM_MS * 2,
+	QUANTUM_MS * 2,
+	QUANTUM_MS * 4,
+	QUANTUM_MS * 4,
+	QUANTUM_MS * 8,
+	QUANTUM_MS * 8,
+};
+
+/**
+ * @brief highest priority level with a ready process
+ * @param rq run queue to look in
+ * @return the level, or -1 if no process is ready
+ */
+static int first_ready_level(struct runq *rq)
+{
+	for (int i = 0; i < NPRIO; i++)
+	{
+		if (!is_empty(&rq->level[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief number of processes a cpu is running or has ready
+ * @param id index of the cpu
+ */
+uint cpu_load(int id)
+{
+	struct cpu *cpu = &cpus[id];
+	return runqs[id].nready + (cpu->proc != cpu->idle);
+}
+
+/**
+ * @brief finds the cpu with the fewest processes to run, which a new process is readied on
+ * @return index of the cpu, the lowest one if there is a tie
+ */
+int least_loaded_cpu()
+{
+	int best = 0;
+	for (int i = 1; i < ncpu; i++)
+	{
+		if (cpu_load(i) < cpu_load(best))
+			best = i;
+	}
+
+	return best;
+}
+
+/**
+ * @brief moves a ready process over to a cpu from the busiest other cpu,
+ * as long as that leaves the busiest cpu with at least as much to do
+ * @param cpu cpu to move the process to
+ * @param load number of processes cpu has to run
+ * @return whether a process was moved
+ */
+static bool steal(struct cpu *cpu, uint load)
+{
+	int busiest  = -1;
+	uint highest = load + 1;
+	for (int i = 0; i < ncpu; i++)
+	{
+		if (i != cpu->id && runqs[i].nready > 0 && cpu_load(i) > highest)
+		{
+			busiest = i;
+			highest = cpu_load(i);
+		}
+	}
+
+	if (busiest < 0)
+		return false;
+
+	// take the process that would wait the longest over there, from the rear of its highest level
+	struct runq *from  = &runqs[busiest];
+	struct runq *to    = &runqs[cpu->id];
+	int level          = first_ready_level(from);
+	struct qnode *node = from->level[level].head.prev;
+
+	queue_remove(&from->level[level], node);
+	from->nready--;
+
+	struct proc *pptr = queue_entry(node, struct proc, qlink);
+	pptr->cpu = cpu->id;
+	insert(&to->level[level], node);
+	to->nready++;
+	return true;
+}
+
+/**
+ * @brief frees the process this cpu just switched away from, if it exited
+ * nothing uses its kernel stack anymore once the switch is done
+ */
+static void reap()
+{
+	struct cpu *cpu = this_cpu();
+	if (cpu->dead)
+	{
+		proc_free(cpu->dead);
+		cpu->dead = NULL;
+	}
+}
 
 void sched()
 {
-	struct proc *pold = curr;
+	// save current interrupt state into current process's mask
+	int mask          = spin_lock(&sched_lock);
+	struct cpu *cpu   = this_cpu();
+	struct proc *pold = cpu->proc;
 	struct proc *pnew;
 
-	// save current interrupt state into current process's mask
-	pold->mask = disable();
+	pold->mask = mask;
+
+	// a process that blocks before using up its allotment is interactive, so it moves up a level
+	if (pold != cpu->idle && (pold->state == PR_WAITING || pold->state == PR_SLEEPING))
+	{
+		if (pold->prio > pold->nice)
+			pold->prio--;
+
+		pold->ticks = 0;
+		pold->slice = 0;
+	}
+
+	// rather than go idle, take work from a busier cpu
+	struct runq *rq = &runqs[cpu->id];
+	int level       = first_ready_level(rq);
+	if (level < 0 && (pold == cpu->idle || pold->state != PR_RUNNING) && steal(cpu, 0))
+		level = first_ready_level(rq);
+
+	// the clock may have stopped ticking while the null process was idle
+	if (pold == cpu->idle && level >= 0)
+		clk_resume();
 
-	if (is_empty(readyq))
+	if (level < 0)
 	{
 		if (pold->state != PR_RUNNING)
-			pnew = &nullproc;
+			pnew = cpu->idle;
 		else
-			pnew = curr;
+			pnew = pold;
 	}
 
+	// only a process of the same or a higher level can take over from a running one
+	else if (pold != cpu->idle && pold->state == PR_RUNNING && pold->prio < level)
+		pnew = pold;
+
 	else
-		pnew = (struct proc *) dequeue(readyq);
+	{
+		pnew = queue_entry(dequeue(&rq->level[level]), struct proc, qlink);
+		rq->nready--;
+	}
+
+	// a process that gets the cpu with no time left starts a fresh slice
+	if (pnew != cpu->idle && pnew->slice == 0)
+		pnew->slice = sched_quantum[pnew->prio];
 
 	if (pnew == pold)
 	{
-		restore(pold->mask);
+		spin_unlock(&sched_lock, pold->mask);
 		return;
 	}
 
-	if (pold != &nullproc && pold->state == PR_RUNNING)
+	if (pold != cpu->idle && pold->state == PR_RUNNING)
+		ready(pold);
+
+	// charge the time the old process ran for
+	u32 now = uptime_ms();
+	if (pold != cpu->idle)
+		pold->cputime += now - pold->dispatched;
+
+	pnew->dispatched = now;
+
+	cpu->proc   = pnew;
+	pnew->state = PR_RUNNING;
+	pnew->cpu   = cpu->id;
+
+	fpu_switch(pold, pnew);
+
+	// an exiting process is still running on its kernel stack, so the next one frees it
+	if (pold->state == PR_TERMINATED && !pold->joinable)
+		cpu->dead = pold;
+
+	// a process blocking in a system call lets other cpus make system calls until it runs again
+	uint kdepth = spin_unlock_all(&kernel_lock);
+
+	// the process switched to releases sched_lock. how deeply this process holds it
+	// is its own business though, so put that back once it runs again
+	uint depth = sched_lock.depth;
+	ctxsw(pold, pnew);
+	sched_lock.depth = depth;
+	reap();
+
+	// kernel_lock is always taken before sched_lock, and the caller may hold sched_lock more than
+	// once (wait(), sleepms()), so let go of it entirely while taking kernel_lock back
+	if (kdepth)
 	{
-		pold->state = PR_READY;
-		insert(readyq, pold);
+		depth = spin_unlock_all(&sched_lock);
+		spin_relock(&kernel_lock, kdepth);
+		spin_relock(&sched_lock, depth);
 	}
 
-	curr = pnew;
-	curr->state = PR_RUNNING;
-	ctxsw(pold, pnew);
-	restore(pold->mask);
+	spin_unlock(&sched_lock, pold->mask);
+}
+
+/**
+ * @brief called by a new process the first time it runs, instead of returning from sched()
+ * releases sched_lock, which the process that switched to it was holding. the new process
+ * keeps running with interrupts disabled, until its entry point enables them
+ */
+void sched_entry()
+{
+	reap();
+	sched_lock.depth = 1;
+	spin_unlock(&sched_lock, 0);
+}
+
+/**
+ * @brief charges a clock tick to the running process, called from the clock handler every ms
+ * preempts the running process once its time slice is up, or as soon as a process
+ * of a higher priority level is ready
+ */
+void sched_tick()
+{
+	int mask          = spin_lock(&sched_lock);
+	struct cpu *cpu   = this_cpu();
+	struct proc *pptr = cpu->proc;
+	struct runq *rq   = &runqs[cpu->id];
+
+	u32 now = uptime_ms();
+	if (now - balanced[cpu->id] >= BALANCE_MS)
+	{
+		balanced[cpu->id] = now;
+		steal(cpu, cpu_load(cpu->id));
+	}
+
+	// a cpu running softirqs has to finish them before it may switch processes, see do_softirq()
+	if (pptr == cpu->idle)
+	{
+		if (!cpu->in_softirq && (first_ready_level(rq) >= 0 || steal(cpu, 0)))
+			sched();
+
+		spin_unlock(&sched_lock, mask);
+		return;
+	}
+
+	// demote the process once it has used up its allotment at this level.
+	// the demotion takes effect the next time it is put back in a ready queue
+	if (++pptr->ticks >= MLFQ_ALLOTMENT)
+	{
+		if (pptr->prio < NPRIO - 1)
+			pptr->prio++;
+
+		pptr->ticks = 0;
+	}
+
+	if (pptr->slice > 0)
+		pptr->slice--;
+
+	int level = first_ready_level(rq);
+	if (level >= 0 && !cpu->in_softirq && (pptr->slice == 0 || level < pptr->prio))
+		sched();
+
+	spin_unlock(&sched_lock, mask);
+}
+
+/**
+ * @brief moves every process back up to its base priority level
+ * called periodically from the clock handler, so cpu bound processes stuck on
+ * the lowest levels still run every so often
+ */
+void sched_boost()
+{
+	int mask = spin_lock(&sched_lock);
+
+	for (int i = 0; i < NPROC; i++)
+	{
+		struct proc *pptr = proctab[i];
+		if (!pptr)
+			continue;
+
+		// a ready process moves to the queue of its new level
+		if (pptr->state == PR_READY && pptr->prio != pptr->nice)
+		{
+			struct runq *rq = &runqs[pptr->cpu];
+			queue_remove(&rq->level[pptr->prio], &pptr->qlink);
+			insert(&rq->level[pptr->nice], &pptr->qlink);
+		}
+
+		pptr->prio  = pptr->nice;
+		pptr->ticks = 0;
+	}
+
+	spin_unlock(&sched_lock, mask);
+}
+
+/**
+ * @brief switches away from the idle process if a process has been readied on this cpu
+ * called on the way out of every interrupt, which includes the ipi another cpu sends
+ * when it readies a process here
+ */
+void sched_wakeup()
+{
+	int mask        = spin_lock(&sched_lock);
+	struct cpu *cpu = this_cpu();
+
+	if (cpu->proc == cpu->idle && !cpu->in_softirq && runqs[cpu->id].nready > 0)
+		sched();
+
+	spin_unlock(&sched_lock, mask);
 }
@@ -14,42 +14,42 @@
 #include <kprintf.h>
 #include <proc.h>
 
-extern struct proc *curr;
-
 struct sem sem;
 
 void sem_init()
 {
 	sem.count = 0;
-	sem.waitq = newq();
+	queue_init(&sem.waitq);
 }
 
+// the semaphore's wait queue holds processes, so it is protected by sched_lock like the ready queues are
 void wait()
 {
-	int mask = disable();
+	int mask = spin_lock(&sched_lock);
 	if (--sem.count < 0)
 	{
-		curr->state = PR_WAITING;
-		insert(sem.waitq, curr);
+		struct proc *pptr = this_cpu()->proc;
+		pptr->state = PR_WAITING;
+		insert(&sem.waitq, &pptr->qlink);
 		sched();
 	}
-	restore(mask);
+	spin_unlock(&sched_lock, mask);
 }
 
 void signal()
 {
-	int mask = disable();
+	int mask = spin_lock(&sched_lock);
 	if (++sem.count >= 0)
 	{
-		struct proc *pptr = (struct proc *) dequeue(sem.waitq);
-		if (!pptr)
+		struct qnode *node = dequeue(&sem.waitq);
+		if (!node)
 		{
-			restore(mask);
+			spin_unlock(&sched_lock, mask);
 			return;
 		}
 
-		ready(pptr);
+		ready(queue_entry(node, struct proc, qlink));
 		sched();
 	}
-	restore(mask);
+	spin_unlock(&sched_lock, mask);
 }
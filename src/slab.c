@@ -0,0 +1,290 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: slab.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: slab allocator for fixed size kernel objects
+ * RESOURCE: https://people.eecs.berkeley.edu/~kubitron/courses/cs194-24-S13/hand-outs/bonwick_slab.pdf
+ *
+ * Each cache hands out objects of a single size. Objects come from slabs, which are
+ * runs of whole pages from pmm_alloc() mapped into a dedicated region of kernel memory.
+ * Free objects in a slab are threaded together into a freelist, so allocating or freeing
+ * an object is just a push or pop of that list.
+ */
+#include <slab.h>
+
+#include <intr.h>
+#include <kmalloc.h>
+#include <kprintf.h>
+#include <meminfo.h>
+#include <pmm.h>
+#include <spinlock.h>
+#include <vmm.h>
+
+// every cache that has been created
+static struct kmem_cache *caches = NULL;
+
+// next unused address in the slab region
+static uintptr_t slab_top = KSLAB_BASE;
+
+// protects every cache and the slab region
+static struct spinlock slab_lock = SPINLOCK_INIT("slab");
+
+// rounds an number x up to the nearest multiple of 8
+#define round8(x) ((x + 7) & ~0x7)
+
+static inline void **free_ptr(struct kmem_cache *cache, void *obj)
+{
+	return (void **) ((u8 *) obj + cache->free_off);
+}
+
+static inline void list_remove(struct slab **list, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+static inline void list_push(struct slab **list, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+
+	if (*list)
+		(*list)->prev = slab;
+
+	*list = slab;
+}
+
+/**
+ * @brief creates a new cache of objects
+ * @param name name of the cache
+ * @param size size in bytes of each object
+ * @param ctor function called to initialize each object when its slab is created, or NULL
+ * @return pointer to the new cache
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct kmem_cache *cache = kmalloc(sizeof(struct kmem_cache));
+
+	cache->name    = name;
+	cache->objsize = size;
+	cache->ctor    = ctor;
+	cache->partial = NULL;
+	cache->full    = NULL;
+	cache->empty   = NULL;
+	cache->nslabs  = 0;
+	cache->nactive = 0;
+
+	// a constructed object has to keep its state while free,
+	// so store its freelist pointer after the object instead of inside it
+	if (ctor)
+	{
+		cache->free_off = round8(size);
+		cache->stride   = cache->free_off + sizeof(void *);
+	}
+
+	else
+	{
+		cache->free_off = 0;
+		cache->stride   = size < sizeof(void *) ? sizeof(void *) : size;
+	}
+
+	cache->stride = round8(cache->stride);
+
+	// grow the slab until it holds a reasonable number of objects
+	size_t pages = 1;
+	while (pages < SLAB_MAX_PAGES && (pages * PAGE_SIZE - sizeof(struct slab)) / cache->stride < SLAB_MIN_OBJS)
+		pages *= 2;
+
+	cache->slab_size     = pages * PAGE_SIZE;
+	cache->objs_per_slab = (cache->slab_size - round8(sizeof(struct slab))) / cache->stride;
+
+	if (cache->objs_per_slab == 0)
+		kprintf("kmem_cache_create: %s objects are too large for a slab!\n", name);
+
+	int mask = spin_lock(&slab_lock);
+	cache->next = caches;
+	caches      = cache;
+	spin_unlock(&slab_lock, mask);
+
+	return cache;
+}
+
+/**
+ * @brief creates a new slab for a cache
+ * @param cache cache that will own the slab
+ * @return the new slab, or NULL if the slab region or physical memory is exhausted
+ */
+static struct slab *slab_create(struct kmem_cache *cache)
+{
+	// align the slab to its size so objects can find it by masking their address
+	uintptr_t virt = (slab_top + cache->slab_size - 1) & -cache->slab_size;
+	if (virt + cache->slab_size > KSLAB_BASE + KSLAB_SIZE)
+	{
+		kprintf("slab_create: slab region exhausted!\n");
+		return NULL;
+	}
+
+	for (size_t off = 0; off < cache->slab_size; off += PAGE_SIZE)
+	{
+		uintptr_t phys = pmm_alloc();
+		if (phys != (uintptr_t) -1 && vmm_map_page(phys, virt + off, PT_PRESENT | PT_WRITABLE) == 0)
+			continue;
+
+		// give back the pages mapped so far. slab_top hasn't moved, so the next slab reuses the range
+		if (phys != (uintptr_t) -1)
+			pmm_free(phys);
+
+		vmm_unmap_range(virt, virt + off);
+		kprintf("slab_create: out of memory!\n");
+		return NULL;
+	}
+
+	slab_top = virt + cache->slab_size;
+
+	struct slab *slab = (struct slab *) virt;
+	slab->cache       = cache;
+	slab->inuse       = 0;
+	slab->freelist    = NULL;
+
+	// thread every object onto the freelist, last object first so the freelist is in address order
+	u8 *objs = (u8 *) virt + round8(sizeof(struct slab));
+	for (int i = cache->objs_per_slab - 1; i >= 0; i--)
+	{
+		void *obj = objs + i * cache->stride;
+
+		if (cache->ctor)
+			cache->ctor(obj);
+
+		*free_ptr(cache, obj) = slab->freelist;
+		slab->freelist        = obj;
+	}
+
+	cache->nslabs++;
+	return slab;
+}
+
+/**
+ * @brief allocates an object from a cache
+ * @param cache cache to allocate from
+ * @return pointer to the allocated object, or NULL if a new slab was needed and couldn't be made
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	// caches are shared with interrupt handlers and other cpus
+	int mask = spin_lock(&slab_lock);
+	struct slab *slab = cache->partial;
+
+	if (!slab)
+	{
+		slab = cache->empty;
+		if (slab)
+			list_remove(&cache->empty, slab);
+
+		else if (!(slab = slab_create(cache)))
+		{
+			spin_unlock(&slab_lock, mask);
+			return NULL;
+		}
+
+		list_push(&cache->partial, slab);
+	}
+
+	void *obj      = slab->freelist;
+	slab->freelist = *free_ptr(cache, obj);
+	slab->inuse++;
+	cache->nactive++;
+
+	if (!slab->freelist)
+	{
+		list_remove(&cache->partial, slab);
+		list_push(&cache->full, slab);
+	}
+
+	spin_unlock(&slab_lock, mask);
+	return obj;
+}
+
+/**
+ * @brief returns an object to the cache it was allocated from
+ * @param cache cache the object was allocated from
+ * @param obj object to free
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	if (!obj)
+		return;
+
+	struct slab *slab = (struct slab *) ((uintptr_t) obj & -cache->slab_size);
+
+	if (slab->cache != cache)
+	{
+		kprintf("kmem_cache_free: 0x%x does not belong to %s!\n", obj, cache->name);
+		return;
+	}
+
+	int mask = spin_lock(&slab_lock);
+
+	// a full slab is about to have a free object again
+	if (!slab->freelist)
+	{
+		list_remove(&cache->full, slab);
+		list_push(&cache->partial, slab);
+	}
+
+	*free_ptr(cache, obj) = slab->freelist;
+	slab->freelist        = obj;
+	slab->inuse--;
+	cache->nactive--;
+
+	if (slab->inuse == 0)
+	{
+		list_remove(&cache->partial, slab);
+		list_push(&cache->empty, slab);
+	}
+
+	spin_unlock(&slab_lock, mask);
+}
+
+/**
+ * @brief fills in the slab counters of a meminfo
+ * @param info meminfo to fill in
+ */
+void slab_meminfo(struct meminfo *info)
+{
+	info->slab_caches = 0;
+	info->slab_pages  = 0;
+	info->slab_bytes  = 0;
+
+	int mask = spin_lock(&slab_lock);
+	for (struct kmem_cache *cache = caches; cache; cache = cache->next)
+	{
+		info->slab_caches++;
+		info->slab_pages += cache->nslabs * cache->slab_size / PAGE_SIZE;
+		info->slab_bytes += cache->nactive * cache->objsize;
+	}
+
+	spin_unlock(&slab_lock, mask);
+}
+
+void print_caches()
+{
+	kprintf("\tSLAB CACHES\n");
+
+	for (struct kmem_cache *cache = caches; cache; cache = cache->next)
+	{
+		kprintf("%s: objsize %d, %d per slab, %d slabs, %d active\n",
+		        cache->name,
+		        cache->objsize,
+		        cache->objs_per_slab,
+		        cache->nslabs,
+		        cache->nactive);
+	}
+}
@@ -0,0 +1,534 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: smp.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: brings up the application processors
+ *
+ * The cpus are found through the MP configuration table the bios leaves in memory. The boot cpu
+ * starts every other cpu (an ap) with an INIT and two STARTUP ipis from its local apic, which sends
+ * the ap into the startup code in trampoline.s. Each ap ends up in ap_main(), running its own idle
+ * process, and from then on it runs processes from the ready queues like the boot cpu does.
+ *
+ * The pic keeps delivering every irq to the boot cpu alone, through its local apic in virtual
+ * wire mode. So the boot cpu handles devices and keeps time with the PIT, while each ap is
+ * preempted by its own local apic timer instead.
+ */
+#include <smp.h>
+
+#include <clk.h>
+#include <fpu.h>
+#include <idt.h>
+#include <intr.h>
+#include <io.h>
+#include <kprintf.h>
+#include <pmm.h>
+#include <proc.h>
+#include <vmm.h>
+
+#include <string.h>
+
+// virtual address the local apic's registers are mapped at. every cpu's local apic
+// sits at the same physical address, and each cpu only ever sees its own there
+#define LAPIC_VIRT     0xfee00000
+
+// local apic registers, as offsets in bytes
+#define LAPIC_ID       0x020    // id
+#define LAPIC_TPR      0x080    // task priority
+#define LAPIC_EOI      0x0b0    // end of interrupt
+#define LAPIC_SVR      0x0f0    // spurious interrupt vector
+#define LAPIC_ESR      0x280    // error status
+#define LAPIC_ICRLO    0x300    // interrupt command, low half
+#define LAPIC_ICRHI    0x310    // interrupt command, high half (destination)
+#define LAPIC_LVT_TMR  0x320    // timer local vector table entry
+#define LAPIC_LINT0    0x350    // lint0 local vector table entry
+#define LAPIC_LINT1    0x360    // lint1 local vector table entry
+#define LAPIC_LVT_ERR  0x370    // error local vector table entry
+#define LAPIC_TICR     0x380    // timer initial count
+#define LAPIC_TCCR     0x390    // timer current count
+#define LAPIC_TDCR     0x3e0    // timer divide configuration
+
+// register bits
+#define LAPIC_ENABLE   0x100      // svr: apic software enable
+#define LAPIC_INIT     0x500      // icr: init ipi
+#define LAPIC_STARTUP  0x600      // icr: startup ipi
+#define LAPIC_NMI      0x400      // lvt: deliver as nmi
+#define LAPIC_EXTINT   0x700      // lvt: deliver as an interrupt from the pic
+#define LAPIC_DELIVS   0x1000     // icr: ipi still being delivered
+#define LAPIC_ASSERT   0x4000     // icr: assert (rather than deassert) level
+#define LAPIC_LEVEL    0x8000     // icr: level triggered
+#define LAPIC_MASKED   0x10000    // lvt: interrupt is masked
+#define LAPIC_PERIODIC 0x20000    // lvt timer: periodic rather than one shot
+#define LAPIC_DIV16    0x3        // tdcr: timer counts at the bus frequency / 16
+
+// length in ms of the local apic timer calibration
+#define CALIBRATE_MS   10
+
+// MP floating pointer structure, which points to the configuration table
+struct mp_fp
+{
+	char sig[4];      // "_MP_"
+	u32 config;       // physical address of the configuration table
+	u8 length;        // length in 16 byte units
+	u8 rev;
+	u8 checksum;      // all bytes add up to 0
+	u8 type;          // default configuration type, or 0 if there is a configuration table
+	u8 features[4];
+} __attribute__((packed));
+
+// MP configuration table header, which is followed by count entries
+struct mp_conf
+{
+	char sig[4];      // "PCMP"
+	u16 length;       // length of the table in bytes, including the header
+	u8 rev;
+	u8 checksum;      // all bytes add up to 0
+	char oem[8];
+	char product[12];
+	u32 oem_table;
+	u16 oem_length;
+	u16 count;        // number of entries
+	u32 lapic;        // physical address of every cpu's local apic
+	u16 xlength;
+	u8 xchecksum;
+	u8 reserved;
+} __attribute__((packed));
+
+// MP configuration table processor entry
+struct mp_proc
+{
+	u8 type;          // MP_PROC
+	u8 apic_id;       // id of the processor's local apic
+	u8 apic_ver;
+	u8 flags;         // MP_PROC_* flags
+	u32 signature;
+	u32 features;
+	u32 reserved[2];
+} __attribute__((packed));
+
+// MP configuration table entry types. every entry but a processor entry is 8 bytes long
+#define MP_PROC         0
+#define MP_BUS          1
+#define MP_IOAPIC       2
+#define MP_IOINTR       3
+#define MP_LINTR        4
+
+#define MP_PROC_ENABLED 0x1    // processor is usable
+
+// arguments for the ap startup code, see trampoline.s
+struct ap_args
+{
+	u32 cr3;
+	u32 cr4;
+	u32 stack;
+	u32 cpu;
+};
+
+// defined in trampoline.s
+extern u8 trampoline[];
+extern u8 trampoline_end[];
+extern struct ap_args trampoline_args;
+
+// defined in start.s
+extern u8 gdt_ts[];
+
+struct cpu cpus[NCPU];
+
+// number of cpus running
+int ncpu = 1;
+
+// every cpu's idle process. an ap's idle process runs on its own kernel stack,
+// while the boot cpu's keeps running on the stack it booted on
+static struct proc idleproc[NCPU];
+
+static volatile u32 *lapic;
+
+// local apic timer ticks in a ms
+static u32 lapic_per_ms;
+
+static inline u32 lapic_read(u32 reg)
+{
+	return lapic[reg / 4];
+}
+
+static inline void lapic_write(u32 reg, u32 value)
+{
+	lapic[reg / 4] = value;
+
+	// read the id back, which waits until the write has been done
+	(void) lapic[LAPIC_ID / 4];
+}
+
+// adds up the bytes of a table, which is 0 for a valid one
+static u8 checksum(void *addr, uint len)
+{
+	u8 sum = 0;
+	for (uint i = 0; i < len; i++)
+		sum += ((u8 *) addr)[i];
+
+	return sum;
+}
+
+// looks for the MP floating pointer in len bytes of memory starting at phys
+static struct mp_fp *mp_search(uintptr_t phys, uint len)
+{
+	u8 *start = PHYS_TO_VIRT(phys);
+	for (u8 *p = start; p < start + len; p += sizeof(struct mp_fp))
+	{
+		if (memcmp(p, "_MP_", 4) == 0 && checksum(p, sizeof(struct mp_fp)) == 0)
+			return (struct mp_fp *) p;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief finds the MP floating pointer, which is in the first 1K of the extended bios data area,
+ * the last 1K of base memory, or the bios rom, in that order
+ * @return the floating pointer, or NULL if there isn't one
+ */
+static struct mp_fp *mp_find()
+{
+	u8 *bda = PHYS_TO_VIRT(0x400);
+	struct mp_fp *fp;
+
+	uintptr_t ebda = *(u16 *) (bda + 0x0e) << 4;
+	if (ebda && (fp = mp_search(ebda, 1024)))
+		return fp;
+
+	uintptr_t base_end = *(u16 *) (bda + 0x13) * 1024;
+	if ((fp = mp_search(base_end - 1024, 1024)))
+		return fp;
+
+	return mp_search(0xf0000, 0x10000);
+}
+
+/**
+ * @brief reads the local apic ids of every usable cpu out of the MP configuration table
+ * @param ids array filled with up to max ids
+ * @param max size of ids
+ * @return number of ids filled in, or 0 if there is no usable configuration table
+ */
+static int mp_cpus(u8 *ids, int max)
+{
+	struct mp_fp *fp = mp_find();
+
+	// a default configuration (which has no table) is a relic of the earliest mp systems
+	if (!fp || fp->type != 0 || fp->config >= pmm_mem_end())
+		return 0;
+
+	struct mp_conf *conf = PHYS_TO_VIRT(fp->config);
+	if (memcmp(conf->sig, "PCMP", 4) != 0 || checksum(conf, conf->length) != 0)
+	{
+		kprintf("SMP: bad mp configuration table at 0x%x\n", fp->config);
+		return 0;
+	}
+
+	// map the local apic uncached, since reading and writing it talks to the apic itself
+	vmm_map_page(conf->lapic, LAPIC_VIRT, PT_PRESENT | PT_WRITABLE | PT_NOCACHE);
+	lapic = (volatile u32 *) LAPIC_VIRT;
+
+	int n   = 0;
+	u8 *p   = (u8 *) (conf + 1);
+	u8 *end = (u8 *) conf + conf->length;
+	while (p < end)
+	{
+		if (*p == MP_PROC)
+		{
+			struct mp_proc *proc = (struct mp_proc *) p;
+			if ((proc->flags & MP_PROC_ENABLED) && n < max)
+				ids[n++] = proc->apic_id;
+
+			p += sizeof(struct mp_proc);
+		}
+
+		else if (*p == MP_BUS || *p == MP_IOAPIC || *p == MP_IOINTR || *p == MP_LINTR)
+			p += 8;
+
+		else
+		{
+			kprintf("SMP: unknown mp configuration entry type %d\n", *p);
+			break;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @brief turns on this cpu's local apic
+ * @param bsp true on the boot cpu, which keeps getting irqs from the pic through lint0
+ * (virtual wire mode) and nmis through lint1. the other cpus only take interrupts from their own timer
+ */
+static void lapic_init(bool bsp)
+{
+	lapic_write(LAPIC_SVR, LAPIC_ENABLE | LAPIC_SPURIOUS);
+	lapic_write(LAPIC_LINT0, bsp ? LAPIC_EXTINT : LAPIC_MASKED);
+	lapic_write(LAPIC_LINT1, bsp ? LAPIC_NMI : LAPIC_MASKED);
+	lapic_write(LAPIC_LVT_ERR, LAPIC_MASKED);
+
+	// the error status register has to be written twice to clear it
+	lapic_write(LAPIC_ESR, 0);
+	lapic_write(LAPIC_ESR, 0);
+
+	// acknowledge anything left outstanding, and accept interrupts of every priority
+	lapic_write(LAPIC_EOI, 0);
+	lapic_write(LAPIC_TPR, 0);
+
+	if (bsp)
+		lapic_write(LAPIC_LVT_TMR, LAPIC_MASKED);
+
+	// an ap ticks every ms, just like the PIT does for the boot cpu
+	else
+	{
+		lapic_write(LAPIC_TDCR, LAPIC_DIV16);
+		lapic_write(LAPIC_LVT_TMR, LAPIC_PERIODIC | LAPIC_TIMER);
+		lapic_write(LAPIC_TICR, lapic_per_ms);
+	}
+}
+
+/**
+ * @brief measures how fast the local apic timer counts, which is the same on every cpu
+ * @return local apic timer ticks in a ms
+ */
+static u32 lapic_calibrate()
+{
+	lapic_write(LAPIC_TDCR, LAPIC_DIV16);
+	lapic_write(LAPIC_LVT_TMR, LAPIC_MASKED);
+	lapic_write(LAPIC_TICR, 0xffffffff);
+	udelay(CALIBRATE_MS * 1000);
+
+	u32 left = lapic_read(LAPIC_TCCR);
+	lapic_write(LAPIC_TICR, 0);
+	return (0xffffffff - left) / CALIBRATE_MS;
+}
+
+// sends an ipi to the cpu with the given local apic id, and waits until it has been delivered
+static void lapic_ipi(u8 apic_id, u32 cmd)
+{
+	lapic_write(LAPIC_ICRHI, apic_id << 24);
+	lapic_write(LAPIC_ICRLO, cmd);
+
+	while (lapic_read(LAPIC_ICRLO) & LAPIC_DELIVS)
+		;
+}
+
+/**
+ * @brief acknowledges an interrupt from this cpu's local apic
+ */
+void lapic_eoi()
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+// the local apic timer of every ap calls this every ms
+static void lapic_tick()
+{
+	sched_tick();
+}
+
+// isr() looks at the run queue on the way out of every interrupt, so the ipi itself has nothing to do
+static void resched()
+{
+}
+
+/**
+ * @brief interrupts an idle cpu so it runs a process just readied on it
+ * @param cpu cpu to interrupt
+ */
+void smp_resched(struct cpu *cpu)
+{
+	if (cpu->started)
+		lapic_ipi(cpu->apic_id, IPI_RESCHED);
+}
+// points a cpu's gdt descriptor at its tss
+static void tss_init(struct cpu *cpu)
+{
+	struct tss *tss = &cpu->tss;
+	memset(tss, 0, sizeof(struct tss));
+	tss->ss0   = 0x10;
+	tss->iomap = sizeof(struct tss);    // no io permission bitmap
+
+	u32 base  = (u32) tss;
+	u32 limit = sizeof(struct tss) - 1;
+	u8 *desc  = gdt_ts + 8 * cpu->id;
+
+	desc[0] = limit >> 0 & 0xff;        // limit (bits 0-15)
+	desc[1] = limit >> 8 & 0xff;
+	desc[2] = base >> 0 & 0xff;         // base (bits 0-23)
+	desc[3] = base >> 8 & 0xff;
+	desc[4] = base >> 16 & 0xff;
+	desc[5] = 0x89;                     // present, 32 bit tss, not busy
+	desc[6] = limit >> 16 & 0xf;        // limit (bits 16-19)
+	desc[7] = base >> 24 & 0xff;        // base (bits 24-31)
+}
+
+// loads a cpu's tss into its task register, which is also how cpu_id() tells the cpus apart
+static void tss_load(struct cpu *cpu)
+{
+	u16 selector = GDT_TSS + 8 * cpu->id;
+	asm volatile("ltr %0" :: "r"(selector));
+}
+
+// sets up a cpu's idle process, which it starts out running
+static void idle_init(struct cpu *cpu)
+{
+	struct proc *idle = &idleproc[cpu->id];
+	strncpy(idle->name, "null process", 32);
+	idle->state  = PR_RUNNING;
+	idle->pid    = -1;
+	idle->mask   = 0;
+	idle->pdir   = vmm_kernel_address_space();
+	idle->stkbtm = (uintptr_t) (idle->kstack + PR_STACKSIZE);
+
+	cpu->idle = idle;
+	cpu->proc = idle;
+}
+
+/**
+ * @brief sets the kernel stack this cpu switches to when an interrupt arrives in user mode
+ * called by ctxsw with interrupts disabled
+ * @param esp0 top of the kernel stack
+ */
+void set_task(u32 esp0)
+{
+	this_cpu()->tss.esp0 = esp0;
+}
+
+/**
+ * @brief where an ap goes once trampoline.s has it running in protected mode on its idle stack
+ * @param id index of the ap into cpus
+ */
+void ap_main(int id)
+{
+	struct cpu *cpu = &cpus[id];
+
+	tss_load(cpu);
+	idt_load();
+	fpu_init();
+	lapic_init(false);
+	cpu->started = true;
+
+	asm("sti");
+
+	// like the boot cpu's null process, zero free memory until there is none left to zero
+	while (1)
+	{
+		if (pmm_refill_zero_pool())
+			continue;
+
+		asm("hlt");
+	}
+}
+
+/**
+ * @brief sends an ap into the startup code, and waits for it to come up
+ * @param cpu cpu to start, with its idle process set up
+ * @return true if the cpu started
+ */
+static bool start_ap(struct cpu *cpu)
+{
+	// copy the startup code down below 1M, and tell it where to go from there
+	u8 *low = PHYS_TO_VIRT(TRAMPOLINE);
+	memcpy(low, trampoline, trampoline_end - trampoline);
+
+	struct ap_args *args = (struct ap_args *) (low + ((u8 *) &trampoline_args - trampoline));
+	args->cr3   = vmm_kernel_address_space();
+	args->stack = cpu->idle->stkbtm;
+	args->cpu   = cpu->id;
+	asm("mov %%cr4, %0" : "=r"(args->cr4));
+
+	// older cpus start at the bios's warm reset vector instead, so point it at the startup code too
+	outb(0x70, 0x0f);
+	outb(0x71, 0x0a);
+	u16 *warm_reset = PHYS_TO_VIRT(0x467);
+	warm_reset[0] = 0;
+	warm_reset[1] = TRAMPOLINE >> 4;
+
+	// an init ipi, then two startup ipis naming the page the code is on, as the mp spec says to
+	lapic_ipi(cpu->apic_id, LAPIC_INIT | LAPIC_LEVEL | LAPIC_ASSERT);
+	lapic_ipi(cpu->apic_id, LAPIC_INIT | LAPIC_LEVEL);
+	udelay(10000);
+
+	for (int i = 0; i < 2; i++)
+	{
+		lapic_ipi(cpu->apic_id, LAPIC_STARTUP | TRAMPOLINE >> 12);
+		udelay(200);
+	}
+
+	for (int i = 0; i < 100 && !cpu->started; i++)
+		udelay(1000);
+
+	return cpu->started;
+}
+
+/**
+ * @brief gives the boot cpu its own tss and idle process, then finds and starts every other cpu
+ * called once the scheduler and memory managers are up, since the aps start running processes right away
+ */
+void smp_init()
+{
+	for (int i = 0; i < NCPU; i++)
+		cpus[i].id = i;
+
+	struct cpu *bsp = &cpus[0];
+	idle_init(bsp);
+	tss_init(bsp);
+	tss_load(bsp);
+	bsp->started = true;
+
+	u8 ids[NCPU * 2];
+	int n = mp_cpus(ids, NCPU * 2);
+	if (n <= 1)
+	{
+		kprintf("SMP: 1 cpu\n");
+		return;
+	}
+
+	bsp->apic_id = lapic_read(LAPIC_ID) >> 24;
+	lapic_init(true);
+	lapic_per_ms = lapic_calibrate();
+	set_vect(LAPIC_TIMER, lapic_tick);
+	set_vect(IPI_RESCHED, resched);
+
+	for (int i = 0; i < n; i++)
+	{
+		if (ids[i] == bsp->apic_id)
+			continue;
+
+		if (ncpu == NCPU)
+		{
+			kprintf("SMP: only using %d cpus\n", NCPU);
+			break;
+		}
+
+		struct cpu *cpu = &cpus[ncpu];
+		cpu->apic_id = ids[i];
+		idle_init(cpu);
+		tss_init(cpu);
+
+		if (start_ap(cpu))
+			ncpu++;
+		else
+			kprintf("SMP: cpu with apic id %d didn't start\n", ids[i]);
+	}
+
+	kprintf("SMP: %d cpus\n", ncpu);
+}
+
+/**
+ * @brief whether every other cpu is running its idle process
+ */
+bool smp_others_idle()
+{
+	int id = cpu_id();
+	for (int i = 0; i < ncpu; i++)
+	{
+		if (i != id && cpus[i].proc != cpus[i].idle)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,78 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: softirq.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: deferred interrupt work that can't block
+ *
+ * A hardware interrupt handler should only do what can't wait, like acknowledging the device and
+ * reading its data, and raise a softirq for the rest. Raised softirqs run on the same cpu on the
+ * way out of the interrupt, after the eoi and with interrupts enabled, so the next interrupt isn't
+ * held up by them. A softirq handler can't block, and the cpu won't switch processes until every
+ * raised softirq has run. Work that needs to block goes in a workqueue instead (see workqueue.c).
+ */
+#include <softirq.h>
+
+#include <intr.h>
+#include <smp.h>
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+
+/**
+ * @brief registers the handler of a softirq
+ * @param nr softirq vector
+ * @param handler function to run when the softirq is raised
+ */
+void open_softirq(int nr, void (*handler)(void))
+{
+	softirq_vec[nr] = handler;
+}
+
+/**
+ * @brief marks a softirq to run on this cpu once the interrupt being handled returns
+ * @param nr softirq vector
+ */
+void raise_softirq(int nr)
+{
+	int mask = disable();
+	this_cpu()->softirqs |= 1 << nr;
+	restore(mask);
+}
+
+/**
+ * @brief runs every softirq raised on this cpu, until none are left
+ * called by isr() with interrupts disabled, and does nothing if this cpu is already running them
+ */
+void do_softirq()
+{
+	int mask        = disable();
+	struct cpu *cpu = this_cpu();
+	if (cpu->in_softirq)
+	{
+		restore(mask);
+		return;
+	}
+
+	// sched_tick() won't switch processes while this is set, so this keeps running on the same cpu
+	cpu->in_softirq = true;
+
+	u32 pending;
+	while ((pending = cpu->softirqs))
+	{
+		cpu->softirqs = 0;
+		asm("sti");
+
+		for (int i = 0; i < NR_SOFTIRQS; i++)
+		{
+			if (pending & (1 << i))
+				softirq_vec[i]();
+		}
+
+		disable();
+	}
+
+	cpu->in_softirq = false;
+	restore(mask);
+}
@@ -10,12 +10,15 @@
 
 [bits 32]
 
+NCPU equ 8                 ; most cpus maestro runs on, must match NCPU in smp.h
+
 global entry
 global kpage_dir
 global kpage_table
 global ident_page_table
-global set_task
 global fb_page_table
+global gdt_ts
+global gdt_descriptor
 
 extern clear
 extern kmain
@@ -34,7 +37,7 @@ mov fs, ax
 mov gs, ax
 mov ss, ax
 
-; set up task segment in gdt like this:
+; set up the boot task segment in gdt like this:
 ;	Base = &tss
 ;	Limit = sizeof(tss)
 ;	Access Byte = 89h
@@ -59,13 +62,6 @@ call kmain
 
 jmp $                      ; kernel should never return
 
-; sets a new task's kernel stack pointer in the esp0 field in tss
-; cdecl - void set_task(u32 esp)
-set_task:
-	mov eax, [esp + 4]
-	mov [tss.esp0], eax
-	ret
-
 ; initialize gdt
 section .data
 gdt:
@@ -107,7 +103,8 @@ gdt_udata:                 ; user mode data segment
 	db 11001111b           ; flags cont., limit (bits 16-19)
 	db 0                   ; base (bits 24-31)
 
-; task segment
+; task segments, one for each cpu
+; cpu 0 starts out with the boot tss below, until smp_init() gives every cpu its own
 gdt_ts:
 	dw 0                   ; limit (bits 0-15)
 	dw 0                   ; base (bits 0-15)
@@ -115,8 +112,10 @@ gdt_ts:
 	db 10001001b           ; flags (access byte)
 	db 0                   ; flags cont., limit (bits 16-19)
 	db 0                   ; base (bits 24-31)
+	times (NCPU - 1) * 8 db 0
 gdt_end:
 
+; boot tss
 tss:
 .prev_tss: dd 0            ; selector of previous task's tss
 .esp0:     dd kstack_top   ; ring0 stack pointer
@@ -152,7 +151,7 @@ dw gdt_end - gdt - 1       ; size of gdt minus 1
 dd gdt                     ; starting address of GDT
 
 section .bss
-; kernel stack
+; kernel stack, which the boot cpu's idle process keeps running on
 align 16
 kstack_bottom:
 resb 16384				   ; reserve 16K for kernel stack
@@ -19,10 +19,47 @@
 
 #include <syscall.h>
 
+#include <clk.h>
 #include <intr.h>
+#include <kmalloc.h>
+#include <meminfo.h>
+#include <pmm.h>
 #include <proc.h>
+#include <slab.h>
+#include <vmm.h>
 #include <vfs.h>
 
+#include <time.h>
+
+struct spinlock kernel_lock = SPINLOCK_INIT("kernel");
+
+/**
+ * @brief checks that a buffer passed in by a process lies entirely in its own regions
+ * the kernel touching anything else would fault in kernel mode, which panics
+ * @param ptr start of the buffer
+ * @param size size of the buffer in bytes
+ * @param flags access the kernel needs, VM_READ or VM_WRITE
+ */
+static bool is_user_buffer(const void *ptr, size_t size, unsigned flags)
+{
+	uintptr_t addr = (uintptr_t) ptr;
+	if (addr < USER_BASE || addr >= KERNEL_BASE || size > KERNEL_BASE - addr)
+		return false;
+
+	// the buffer may span several adjacent regions
+	uintptr_t end = addr + size;
+	while (addr < end)
+	{
+		struct vm_region *region = vmm_find_region(curr, addr);
+		if (!region || (region->flags & flags) != flags)
+			return false;
+
+		addr = region->end;
+	}
+
+	return true;
+}
+
 /**
  * @brief syscall 0 - read
  * @param fd ebx
@@ -79,11 +116,171 @@ void sys_open(struct registers *regs)
 	regs->eax = vfs_open(filename);
 }
 
+/**
+ * @brief syscall 4 - fork
+ * @return pid of the new process in the parent, 0 in the new process, or -1 on failure
+ */
+void sys_fork(struct registers *regs)
+{
+	struct proc *child = fork(regs);
+	if (!child)
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	regs->eax = child->pid;
+	ready(child);
+}
+
+/**
+ * @brief syscall 5 - brk
+ * @param addr ebx
+ * @return the new program break, or the current one if addr is 0 or can't be used
+ */
+void sys_brk(struct registers *regs)
+{
+	uintptr_t addr = regs->ebx;
+	regs->eax = vmm_brk(curr, addr);
+}
+
+/**
+ * @brief syscall 6 - meminfo
+ * @param info ebx
+ * @param pid ecx, or -1 for the calling process
+ * @return 0 on success, or -1 if info is a bad pointer or there is no process with that pid
+ */
+void sys_meminfo(struct registers *regs)
+{
+	struct meminfo *info = (struct meminfo *) regs->ebx;
+	int pid = regs->ecx;
+
+	if (!is_user_buffer(info, sizeof(struct meminfo), VM_WRITE))
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	// another cpu can't free the process between finding and counting it while sched_lock is held
+	int mask = spin_lock(&sched_lock);
+	struct proc *pptr = pid < 0 ? curr : find_proc(pid);
+	if (!pptr)
+	{
+		spin_unlock(&sched_lock, mask);
+		regs->eax = -1;
+		return;
+	}
+
+	uint resident = vmm_resident_pages(pptr);
+	spin_unlock(&sched_lock, mask);
+
+	info->resident_pages = resident;
+	pmm_meminfo(info);
+	vmm_meminfo(info);
+	kmalloc_meminfo(info);
+	slab_meminfo(info);
+
+	regs->eax = 0;
+}
+
+/**
+ * @brief syscall 7 - nice
+ * @param pid ebx, or -1 for the calling process
+ * @param inc ecx
+ * @return the process's new base priority level, or -1 if there is no process with that pid
+ */
+void sys_nice(struct registers *regs)
+{
+	int pid = regs->ebx;
+	int inc = regs->ecx;
+
+	// another cpu can't free the process between finding and changing it while sched_lock is held
+	int mask = spin_lock(&sched_lock);
+	struct proc *pptr = pid < 0 ? curr : find_proc(pid);
+	regs->eax = pptr ? proc_nice(pptr, inc) : -1;
+	spin_unlock(&sched_lock, mask);
+}
+
+/**
+ * @brief syscall 8 - clock_gettime
+ * @param clockid ebx
+ * @param tp ecx
+ * @return 0 on success, or -1 if the clock or tp is bad
+ */
+void sys_clock_gettime(struct registers *regs)
+{
+	clockid_t clockid   = regs->ebx;
+	struct timespec *tp = (struct timespec *) regs->ecx;
+
+	if ((clockid != CLOCK_MONOTONIC && clockid != CLOCK_REALTIME) || !is_user_buffer(tp, sizeof(struct timespec), VM_WRITE))
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	u64 ns      = clock_ns();
+	tp->tv_sec  = ns / 1000000000;
+	tp->tv_nsec = ns % 1000000000;
+	regs->eax   = 0;
+}
+
+/**
+ * @brief syscall 9 - nanosleep
+ * sleeps are rounded up to whole ms, the resolution of the sleep queue
+ * @param req ebx
+ * @param rem ecx, may be NULL
+ * @return 0 on success, or -1 if req is bad
+ */
+void sys_nanosleep(struct registers *regs)
+{
+	const struct timespec *req = (const struct timespec *) regs->ebx;
+	struct timespec *rem       = (struct timespec *) regs->ecx;
+
+	if (!is_user_buffer(req, sizeof(struct timespec), VM_READ) || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	u32 msec = req->tv_sec * 1000 + (req->tv_nsec + 999999) / 1000000;
+	if (msec)
+		sleepms(msec);
+	else
+		sched();
+
+	// nothing can interrupt a sleep yet, so there is never any time remaining
+	if (rem && is_user_buffer(rem, sizeof(struct timespec), VM_WRITE))
+	{
+		rem->tv_sec  = 0;
+		rem->tv_nsec = 0;
+	}
+
+	regs->eax = 0;
+}
+
+/**
+ * @brief syscall 10 - sched_yield
+ * gives the cpu to the next ready process at the same or a higher priority level, if there is one
+ * @return 0
+ */
+void sys_sched_yield(struct registers *regs)
+{
+	sched();
+	regs->eax = 0;
+}
+
 void (*syscall_handlers[])(struct registers *) = {
 	sys_read,
 	sys_write,
     sys_exit,
     sys_open,
+	sys_fork,
+	sys_brk,
+	sys_meminfo,
+	sys_nice,
+	sys_clock_gettime,
+	sys_nanosleep,
+	sys_sched_yield,
 };
 
 const int NUM_SYSCALLS = sizeof(syscall_handlers) / sizeof(syscall_handlers[0]);
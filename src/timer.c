@@ -0,0 +1,302 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: timer.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: kernel timers
+ * RESOURCE: http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+ *
+ * Pending timers live in a hierarchical timing wheel. Level 0 has a slot for each of the next
+ * TIMER_SLOTS ms, level 1 has a slot for each of the next TIMER_SLOTS spans of TIMER_SLOTS ms,
+ * and so on. Adding a timer is just a matter of picking its slot from its delay, and cancelling one
+ * just unlinks it from its slot, so both are O(1) no matter how many timers there are.
+ *
+ * Every ms the clock advances the wheel by one slot, and everything in that slot of level 0 has expired.
+ * Whenever level 0 wraps around, the next slot of level 1 is emptied back into the wheel, where its timers
+ * land in level 0 now that they are close to expiring (a cascade), and the same goes for the levels above.
+ *
+ * Expired timers are only moved to a list by the timer softirq. Their functions are called later
+ * by the timer thread, so a slow callback never holds up the interrupt, and callbacks are free to
+ * do anything a process can.
+ */
+#include <timer.h>
+
+#include <clk.h>
+#include <intr.h>
+#include <kprintf.h>
+#include <proc.h>
+#include <spinlock.h>
+
+static struct queue wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+// timers that have fired, waiting for the timer thread to call them
+static struct queue expired;
+
+// the next timestamp the wheel has yet to process
+static u32 wheel_time;
+
+// process that calls the functions of expired timers
+static struct proc *timerd;
+
+// true while timerd is waiting for timers to expire. callbacks may block, so its state alone can't tell. protected by sched_lock
+static bool timerd_idle;
+
+// protects the wheel and the expired list. never taken before sched_lock, only after it
+static struct spinlock timer_lock = SPINLOCK_INIT("timer");
+
+static int timer_thread(void *);
+
+/**
+ * @brief puts a timer in the wheel slot for its expiration time
+ * must be called with timer_lock held
+ */
+static void enqueue_timer(struct timer *t)
+{
+	u32 delay = t->expires - wheel_time;
+
+	// already expired, so fire it on the very next slot
+	if ((s32) delay < 0)
+	{
+		t->expires = wheel_time;
+		delay      = 0;
+	}
+
+	if (delay > TIMER_MAX_DELAY)
+	{
+		t->expires = wheel_time + TIMER_MAX_DELAY;
+		delay      = TIMER_MAX_DELAY;
+	}
+
+	// the first level with a span longer than the delay
+	int level = 0;
+	while (delay >= 1u << ((level + 1) * TIMER_SLOT_BITS))
+		level++;
+
+	uint slot = (t->expires >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+	t->list   = &wheel[level][slot];
+	insert(t->list, &t->link);
+}
+
+/**
+ * @brief empties a slot of the wheel back into the wheel, at finer grained levels
+ * @param level level of the slot
+ * @param slot index of the slot
+ * @return true if the slot was slot 0, meaning the level above needs to cascade too
+ */
+static bool cascade(int level, uint slot)
+{
+	struct queue *q = &wheel[level][slot];
+	struct qnode *node;
+
+	while ((node = dequeue(q)))
+		enqueue_timer(queue_entry(node, struct timer, link));
+
+	return slot == 0;
+}
+
+/**
+ * @brief sets up the timing wheel and starts the timer thread
+ */
+void timers_init()
+{
+	for (int i = 0; i < TIMER_LEVELS; i++)
+	{
+		for (int j = 0; j < TIMER_SLOTS; j++)
+			queue_init(&wheel[i][j]);
+	}
+
+	queue_init(&expired);
+	wheel_time = uptime_ms();
+
+	timerd = kthread_create(timer_thread, NULL, "timerd");
+}
+
+/**
+ * @brief initializes a timer, which starts out not pending
+ * @param t timer to initialize
+ * @param func function to call when the timer fires
+ * @param arg argument to pass to func
+ */
+void timer_setup(struct timer *t, void (*func)(void *), void *arg)
+{
+	t->list = NULL;
+	t->func = func;
+	t->arg  = arg;
+}
+
+/**
+ * @brief starts a timer
+ * @param t timer to start, which must not already be pending
+ * @param delay number of ms from now the timer fires in
+ */
+void timer_add(struct timer *t, u32 delay)
+{
+	int mask = spin_lock(&timer_lock);
+
+	if (t->list)
+	{
+		spin_unlock(&timer_lock, mask);
+		kprintf("timer_add: timer 0x%x is already pending!\n", t);
+		return;
+	}
+
+	t->expires = uptime_ms() + delay;
+	enqueue_timer(t);
+	spin_unlock(&timer_lock, mask);
+}
+
+/**
+ * @brief changes when a timer fires, starting it if it isn't pending
+ * @param t timer to change
+ * @param delay number of ms from now the timer fires in
+ * @return true if the timer was pending
+ */
+bool timer_mod(struct timer *t, u32 delay)
+{
+	int mask = spin_lock(&timer_lock);
+	bool pending = timer_cancel(t);
+	t->expires   = uptime_ms() + delay;
+	enqueue_timer(t);
+	spin_unlock(&timer_lock, mask);
+	return pending;
+}
+
+/**
+ * @brief stops a timer, if it hasn't fired yet
+ * @param t timer to stop
+ * @return true if the timer was pending, or false if it already fired or was never started
+ */
+bool timer_cancel(struct timer *t)
+{
+	int mask = spin_lock(&timer_lock);
+
+	bool pending = t->list != NULL;
+	if (pending)
+	{
+		queue_remove(t->list, &t->link);
+		t->list = NULL;
+	}
+
+	spin_unlock(&timer_lock, mask);
+	return pending;
+}
+
+/**
+ * @brief whether a timer is waiting to fire
+ * @param t timer to check
+ */
+bool timer_pending(struct timer *t)
+{
+	return t->list != NULL;
+}
+
+/**
+ * @brief advances the timing wheel up to the current time, called by the timer softirq
+ * @param now current timestamp in ms
+ */
+void timer_tick(u32 now)
+{
+	int mask = spin_lock(&timer_lock);
+	while ((s32) (now - wheel_time) >= 0)
+	{
+		uint slot = wheel_time & (TIMER_SLOTS - 1);
+
+		// level 0 wrapped around, so bring the next span of each level above down into the wheel
+		if (slot == 0)
+		{
+			for (int level = 1; level < TIMER_LEVELS; level++)
+			{
+				uint upper = (wheel_time >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+				if (!cascade(level, upper))
+					break;
+			}
+		}
+
+		struct queue *q = &wheel[0][slot];
+		struct qnode *node;
+		while ((node = dequeue(q)))
+		{
+			struct timer *t = queue_entry(node, struct timer, link);
+			t->list = &expired;
+			insert(&expired, &t->link);
+		}
+
+		wheel_time++;
+	}
+
+	bool fired = !is_empty(&expired);
+	spin_unlock(&timer_lock, mask);
+
+	// timerd checks for expired timers and goes to sleep all under sched_lock,
+	// so it can't miss this wakeup in between
+	if (fired)
+	{
+		mask = spin_lock(&sched_lock);
+		if (timerd_idle)
+		{
+			timerd_idle = false;
+			ready(timerd);
+		}
+
+		spin_unlock(&sched_lock, mask);
+	}
+}
+
+/**
+ * @brief the earliest time the wheel next has work to do, which is when the next timer
+ * fires or the wheel next cascades, whichever comes first. a cascade may not fire anything,
+ * but after it the wheel knows exactly when the timers it brought down are due
+ * @return timestamp in ms, at most TIMER_SLOTS ms from now
+ */
+u32 timer_next_expiry()
+{
+	int mask = spin_lock(&timer_lock);
+
+	u32 t = wheel_time;
+	for (uint i = 0; i < TIMER_SLOTS; i++, t++)
+	{
+		if (!is_empty(&wheel[0][t & (TIMER_SLOTS - 1)]) || (i > 0 && (t & (TIMER_SLOTS - 1)) == 0))
+			break;
+	}
+
+	spin_unlock(&timer_lock, mask);
+	return t;
+}
+
+/**
+ * @brief body of the timer thread, which calls the function of every expired timer
+ * and then waits for the clock to expire more. never returns
+ */
+static int timer_thread(void *arg)
+{
+	(void) arg;
+	while (1)
+	{
+		int mask  = spin_lock(&sched_lock);
+		int tmask = spin_lock(&timer_lock);
+
+		struct qnode *node;
+		while ((node = dequeue(&expired)))
+		{
+			struct timer *t = queue_entry(node, struct timer, link);
+			t->list = NULL;
+
+			// the timer is no longer pending, so its function may add it again
+			spin_unlock(&timer_lock, tmask);
+			spin_unlock(&sched_lock, mask);
+			t->func(t->arg);
+			mask  = spin_lock(&sched_lock);
+			tmask = spin_lock(&timer_lock);
+		}
+
+		spin_unlock(&timer_lock, tmask);
+		timerd_idle = true;
+		this_cpu()->proc->state = PR_WAITING;
+		sched();
+		spin_unlock(&sched_lock, mask);
+	}
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+; maestro
+; License: GPLv2
+; See LICENSE.txt for full license text
+; Author: Sam Kravitz
+;
+; FILE: trampoline.s
+; DATE: October 17th, 2026
+; DESCRIPTION: startup code for the application processors
+;
+; an ap (any cpu besides the boot cpu) starts out in real mode, at the page named by the
+; startup ipi that woke it up. smp_init() copies everything from trampoline to trampoline_end
+; down to TRAMPOLINE, fills in trampoline_args in the copy, then sends the ipi.
+; the copy switches to protected mode with a temporary gdt, turns on paging with the kernel's
+; page directory, and jumps up to ap_start in the kernel image, which loads the real gdt and
+; calls ap_main() on the cpu's idle stack. the first 4M of memory is identity mapped in every
+; address space, so the copy is still reachable right after paging is turned on
+
+[bits 16]
+
+TRAMPOLINE equ 7000h               ; must match TRAMPOLINE in smp.h
+
+	global trampoline
+	global trampoline_end
+	global trampoline_args
+
+	extern gdt_descriptor
+	extern ap_main
+
+; address of a label in the copy at TRAMPOLINE
+%define LOW(label) (TRAMPOLINE + (label) - trampoline)
+
+	section .text
+
+trampoline:
+	cli
+	cld
+	mov ax, cs                         ; cs is TRAMPOLINE >> 4, so ds addresses the copy
+	mov ds, ax
+
+	lgdt [tgdt_descriptor - trampoline]
+
+	mov eax, cr0                       ; set the protected mode bit
+	or eax, 1
+	mov cr0, eax
+
+	jmp dword 8h:LOW(.pmode)           ; far jump to load cs with the 32 bit code segment
+
+[bits 32]
+.pmode:
+	mov ax, 10h
+	mov ds, ax
+	mov es, ax
+	mov ss, ax
+
+	mov eax, [LOW(trampoline_args.cr4)]
+	mov cr4, eax                       ; same paging features as the boot cpu (4M and global pages)
+	mov eax, [LOW(trampoline_args.cr3)]
+	mov cr3, eax                       ; kernel page directory
+	mov eax, cr0
+	or eax, 80010000h                  ; paging, and write protect like vmm_init() turns on
+	mov cr0, eax
+
+	mov eax, ap_start                  ; jump up to the kernel's own copy of the code
+	jmp eax
+
+; temporary gdt with the same code and data selectors as the real one
+align 8
+tgdt:
+	dq 0                               ; null descriptor
+	dq 00cf9a000000ffffh               ; kernel code, base 0, limit 4G
+	dq 00cf92000000ffffh               ; kernel data, base 0, limit 4G
+tgdt_descriptor:
+	dw tgdt_descriptor - tgdt - 1      ; size of gdt minus 1
+	dd LOW(tgdt)                       ; physical address of the copy's gdt
+
+; filled in by smp_init() for each ap
+; layout must match struct ap_args in smp.c
+align 4
+trampoline_args:
+.cr3:   dd 0                           ; physical address of the kernel page directory
+.cr4:   dd 0                           ; cr4 of the boot cpu
+.stack: dd 0                           ; top of the idle process's kernel stack
+.cpu:   dd 0                           ; index of the cpu into cpus
+trampoline_end:
+
+; running at the kernel's virtual address now, the ap is like any other cpu from here on
+ap_start:
+	lgdt [gdt_descriptor]
+	jmp 8h:.reload                     ; far jump to reload cs from the real gdt
+
+.reload:
+	mov ax, 10h
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+
+	mov esp, [LOW(trampoline_args.stack)]
+	push dword [LOW(trampoline_args.cpu)]
+	call ap_main                       ; cdecl - void ap_main(int id)
+
+	jmp $                              ; ap_main() never returns
@@ -13,6 +13,7 @@
 #include <kmalloc.h>
 #include <kprintf.h>
 #include <proc.h>
+#include <slab.h>
 #include <tty.h>
 
 #include <stdio.h>
@@ -20,19 +21,28 @@
 
 static struct vnode *root = NULL;
 
+// caches of vfs nodes and open files
+static struct kmem_cache *vnode_cache;
+static struct kmem_cache *file_cache;
+
 static void build_tree(struct vnode *);
 static struct vnode *find(char *);
 static struct vnode *find_parent(char *);
 static struct vnode *find_helper(const struct vnode *, char *);
 static void print_tree(struct vnode *, int);
 
-extern struct proc *curr;
-
 static inline bool is_open(int fd)
 {
 	return curr->ofile[fd] != NULL;
 }
 
+// drops a reference to an open file, freeing it once no file table points to it
+static inline void file_put(struct file *f)
+{
+	if (__sync_sub_and_fetch(&f->refs, 1) == 0)
+		kmem_cache_free(file_cache, f);
+}
+
 static inline void insert_child(struct vnode *parent, struct vnode *child)
 {
 	if (!parent->leftmost_child)
@@ -54,8 +64,11 @@ static inline void insert_child(struct vnode *parent, struct vnode *child)
  */
 void vfs_init()
 {
+	vnode_cache = kmem_cache_create("vnode", sizeof(struct vnode), NULL);
+	file_cache  = kmem_cache_create("file", sizeof(struct file), NULL);
+
 	// allocate root node
-	root                 = (struct vnode *) kmalloc(sizeof(struct vnode));
+	root                 = (struct vnode *) kmem_cache_alloc(vnode_cache);
 	root->inode          = ROOT_INODE;
 	root->type           = DIR_TYPE_DIR;
 	root->num_children   = 0;
@@ -97,7 +110,7 @@ struct vnode *vfs_mkdir(char *path)
 	}
 
 	// allocate memory for the new directory in the tree
-	struct vnode *node = (struct vnode *) kmalloc(sizeof(struct vnode));
+	struct vnode *node = (struct vnode *) kmem_cache_alloc(vnode_cache);
 	node->inode           = inode;
 	node->type            = DIR_TYPE_DIR;
 	node->num_children    = 0;
@@ -141,7 +154,7 @@ struct vnode *vfs_touch(char *path)
 	}
 
 	// allocate memory for the new file in the tree
-	struct vnode *node = (struct vnode *) kmalloc(sizeof(struct vnode));
+	struct vnode *node = (struct vnode *) kmem_cache_alloc(vnode_cache);
 	node->inode           = inode;
 	node->type            = DIR_TYPE_REG;
 	node->num_children    = 0;
@@ -188,10 +201,11 @@ int vfs_open(char *path)
 		return -1;
 	}
 
-	struct file *f = kmalloc(sizeof(struct file));
+	struct file *f = kmem_cache_alloc(file_cache);
 	
 	f->size = ext2_filesize(node->inode);
 	f->pos = 0;
+	f->refs = 1;
 	f->n = node;
 
 	curr->ofile[fd] = f;
@@ -206,7 +220,7 @@ int vfs_close(int fd)
 		return -1;
 	}
 
-	kfree(curr->ofile[fd]);
+	file_put(curr->ofile[fd]);
 	curr->ofile[fd] = NULL;
 	return 0;
 }
@@ -286,6 +300,37 @@ int vfs_write(int fd, void *buff, size_t count)
 	return 0;
 }
 
+/**
+ * @brief gives a forked child the same open files as its parent
+ * the files themselves are shared, seek offset included, so each gains a reference
+ * @param parent process making the call to fork
+ * @param child the new process
+ */
+void vfs_fork(struct proc *parent, struct proc *child)
+{
+	for (int i = 0; i < NOFILE; i++)
+	{
+		child->ofile[i] = parent->ofile[i];
+		if (child->ofile[i])
+			__sync_add_and_fetch(&child->ofile[i]->refs, 1);
+	}
+}
+
+/**
+ * @brief closes every file an exiting process still has open
+ * @param pptr the exiting process
+ */
+void vfs_exit(struct proc *pptr)
+{
+	for (int i = 0; i < NOFILE; i++)
+	{
+		if (pptr->ofile[i])
+		{
+			file_put(pptr->ofile[i]);
+			pptr->ofile[i] = NULL;
+		}
+	}
+}
 
 /**
  * @brief finds the vfs_node associated with a given path
@@ -379,7 +424,7 @@ static void build_tree(struct vnode *node)
 	while (bytes_read < EXT2_BLOCK_SIZE)
 	{
 		// allocate memory for this node
-		struct vnode *child = (struct vnode *) kmalloc(sizeof(struct vnode));
+		struct vnode *child = (struct vnode *) kmem_cache_alloc(vnode_cache);
 		child->inode           = entry->inode;
 		child->type            = entry->type;
 		child->num_children    = 0;
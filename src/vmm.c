@@ -13,14 +13,15 @@
 #include <intr.h>
 #include <kprintf.h>
 #include <kmalloc.h>
+#include <meminfo.h>
 #include <pmm.h>
 #include <proc.h>
+#include <slab.h>
+#include <spinlock.h>
 
 #include <stdio.h>
 #include <string.h>
 
-extern struct proc nullproc;
-
 extern u32 start_phys, start;
 
 // pointer to heap, defined in kmalloc.c
@@ -32,95 +33,946 @@ extern void *heap;
 u32 *PAGE_DIR = (u32 *) 0xfffff000;
 void *PAGE_TABLES = (void *) 0xffc00000;
 
-static void page_fault();
+// physical address of the kernel's page directory
+static uintptr_t kernel_pdir;
+
+// physical addresses of every live page directory, so new kernel page tables can be shared with all of them
+static uintptr_t pdirs[NPROC + 1];
+
+// set bit n denotes kmap slot n is in use
+static u32 kmap_slots;
+
+// true if the cpu supports 4M pages
+static bool has_pse;
+
+// physical memory below this address is mapped at KERNEL_BASE + its physical address
+static uintptr_t direct_map_end;
+
+// cache of memory regions
+static struct kmem_cache *region_cache;
+
+// number of frames allocated for page directories and page tables
+static uint nr_page_tables;
+
+// protects pdirs, nr_page_tables, and kernel page directory entries
+static struct spinlock vmm_lock = SPINLOCK_INIT("vmm");
+
+// protects kmap_slots
+static struct spinlock kmap_lock = SPINLOCK_INIT("kmap");
+
+// page fault error code bits
+#define PF_PRESENT 0x1    // fault was a protection violation on a present page
+#define PF_WRITE   0x2    // fault was caused by a write
+#define PF_USER    0x4    // fault happened in user mode
+
+static bool page_fault(struct registers *);
+static void share_kernel_pde(int);
+
+// true if the page directory entry at index i maps memory every address space shares
+static inline bool is_kernel_pde(int i)
+{
+	return i == 0 || (i >= (int) (KERNEL_BASE >> 22) && i < NUM_TABLE_ENTRIES - 1);
+}
+
+static inline uintptr_t read_cr3()
+{
+	uintptr_t cr3;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+	return cr3;
+}
+
+static inline void invlpg(uintptr_t virt)
+{
+	asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+// page table entry that maps virt in the current address space, or NULL if there is no page table for it
+static inline u32 *get_pte(uintptr_t virt)
+{
+	if (!(PAGE_DIR[virt >> 22] & PT_PRESENT) || (PAGE_DIR[virt >> 22] & PT_LARGE))
+		return NULL;
+
+	u32 *page_table = PAGE_TABLES + (virt >> 22) * PAGE_SIZE;
+	return &page_table[virt >> 12 & 0x3ff];
+}
 
 /**
- * the bootloader kept data structures for initializing paging in the first ~10K of memory.
- * once our pmm is initialized, that region of memory will be marked as available
- * and could be overridden at any point, so we need to copy those data structures
- * to kernel memory so we know it won't be overriden.
- * 
- * the 3 data structures we have to save are the kernel's page directory,
- * the page table that identity maps the first 1M of memory,
- * and the page table that maps the first 4M of the kernel.
+ * the bootloader's page tables live in low memory which the pmm considers available,
+ * so they could be overwritten at any point. they are replaced with a page directory
+ * in memory the pmm has handed out to us.
+ *
+ * the bootloader mapped the first 4M of physical memory at KERNEL_BASE, which is where
+ * the kernel image (at 1M), the pmm's bookkeeping, and the first frames pmm_alloc()
+ * hands out all are. the new page directory maps all of physical memory there instead
+ * (the direct map), using 4M pages when the cpu supports them, so the kernel image and
+ * every frame the kernel touches through the direct map cost a single tlb entry per 4M.
  */
 void vmm_init()
 {
-	set_vect(14, page_fault);
+	set_xint(14, page_fault);
 
-    u32 *kpage_table = (u32 *) pmm_alloc();
-    u32 *kpage_dir = (u32 *) pmm_alloc();
-    u32 *ident_page_table = (u32 *) pmm_alloc();
+	uintptr_t kpage_dir_phys = pmm_alloc();
+	u32 *kpage_dir = PHYS_TO_VIRT(kpage_dir_phys);
+	memset(kpage_dir, 0, PAGE_DIR_SIZE);
 
-    for (int i = 0, phys = (int) &start_phys; i < 1024; i++, phys += PAGE_SIZE)
-    {
-        kpage_dir[i] = 0;
-        kpage_table[i] = phys | PT_PRESENT | PT_WRITABLE;
-        ident_page_table[i] = PT_PRESENT | PT_WRITABLE;
-    }
+	// keep running on the bootloader's mappings until the direct map replaces them
+	u32 *boot_dir = PHYS_TO_VIRT(KPAGE_DIR_BASE);
+	kpage_dir[0] = boot_dir[0];
+	kpage_dir[KERNEL_BASE >> 22] = boot_dir[KERNEL_BASE >> 22];
+
+	// identity map final entry of kernel page directory
+	kpage_dir[1023] = kpage_dir_phys | PT_PRESENT | PT_WRITABLE;
 
-    // set kernel pde for identity page table and kernel page table to new addr
-	kpage_dir[0] = (uintptr_t) ident_page_table | PT_PRESENT | PT_WRITABLE;
-	int i = (u32) &start / 0x400000; // index into kernel page directory that maps the kernel page table
-    kpage_dir[i] = (uintptr_t) kpage_table | PT_PRESENT | PT_WRITABLE;
+	// page table for the kmap window, which has to exist before any other address space does
+	uintptr_t kmap_page_table = pmm_alloc();
+	memset(PHYS_TO_VIRT(kmap_page_table), 0, PAGE_TABLE_SIZE);
+	kpage_dir[KMAP_BASE >> 22] = kmap_page_table | PT_PRESENT | PT_WRITABLE;
+	nr_page_tables = 2;
 
-    // identity map final entry of kernel page directory
-    kpage_dir[1023] = (uintptr_t) kpage_dir | PT_PRESENT | PT_WRITABLE;
+	// 4M pages need cr4.pse, if the cpu has it (cpuid 1, edx bit 3)
+	u32 eax, ebx, ecx, edx;
+	asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+	has_pse = (edx & (1 << 3)) != 0;
+	if (has_pse)
+		asm("mov %%cr4, %0; or $0x10, %0; mov %0, %%cr4" : "=r"(eax));
 
 	// move physical address of kernel page directory to cr3
-	asm("mov %0, %%cr3" :: "r"(kpage_dir));
+	asm("mov %0, %%cr3" :: "r"(kpage_dir_phys));
+
+	// the first 4M stays identity mapped for the bios data area and vga framebuffer
+	vmm_map_large_page(0, 0, PT_PRESENT | PT_WRITABLE);
+
+	// map as much physical memory as fits below the kmap window
+	direct_map_end = (pmm_mem_end() + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+	if (direct_map_end > KMAP_BASE - KERNEL_BASE)
+		direct_map_end = KMAP_BASE - KERNEL_BASE;
 
-    // map physical page of VGA framebuffer
-    vmm_map_page(0xb8000, 0xb8000, PT_PRESENT | PT_WRITABLE);
+	for (uintptr_t phys = 0; phys < direct_map_end; phys += LARGE_PAGE_SIZE)
+		vmm_map_large_page(phys, (uintptr_t) PHYS_TO_VIRT(phys), PT_PRESENT | PT_WRITABLE);
 
-	nullproc.pdir = (uintptr_t) kpage_dir;
-	kmalloc_init(heap, 1024 * 1024);
+	// global pages need cr4.pge, if the cpu has it (cpuid 1, edx bit 13)
+	if (edx & (1 << 13))
+		asm("mov %%cr4, %0; or $0x80, %0; mov %0, %%cr4" : "=r"(eax));
+
+	// make read only pages read only to the kernel too (cr0.wp), otherwise
+	// the kernel could write straight through a copy on write page into a frame another process shares
+	asm("mov %%cr0, %0; or $0x10000, %0; mov %0, %%cr0" : "=r"(eax));
+
+	kernel_pdir = kpage_dir_phys;
+	pdirs[0]    = kernel_pdir;
+	kmalloc_init(heap, KHEAP_SIZE);
+	region_cache = kmem_cache_create("vm_region", sizeof(struct vm_region), NULL);
 }
 
+/**
+ * @brief creates a new address space
+ * user space starts out empty and kernel space is shared with every other address space
+ * @return physical address of the new page directory, or 0 if out of memory or page directory slots
+ */
 uintptr_t vmm_create_address_space()
 {
 	uintptr_t phys = pmm_alloc();
-	struct pde *dir = NULL;
+	if (phys == (uintptr_t) -1)
+		return 0;
+
+	u32 *dir = vmm_kmap(phys);
 
-	for (int i = 0; i < NUM_TABLE_ENTRIES; i++)
+	// every address space has identical kernel entries, so the current one is as good a source as any
+	for (int i = 0; i < NUM_TABLE_ENTRIES - 1; i++)
+		dir[i] = is_kernel_pde(i) ? PAGE_DIR[i] : 0;
+
+	// recursively map the final entry so the new address space can edit its own page tables
+	dir[NUM_TABLE_ENTRIES - 1] = phys | PT_PRESENT | PT_WRITABLE;
+	vmm_kunmap(dir);
+
+	// a page directory missing from pdirs would never see new kernel page tables,
+	// so running out of slots has to fail rather than hand back a directory that goes stale
+	int mask = spin_lock(&vmm_lock);
+	for (int i = 0; i < NPROC + 1; i++)
 	{
-		//if (kpage_table[i].present == 0)
-		//{
-		//	kprintf("%d %x\n",i, kpage_dir[i].addr);
-		//	kpage_table[i].present = 1;
-		//	kpage_table[i].addr = phys >> 12;
-		//	dir = (struct pde *) &kpage_table[i];
-		//	break;
-		//}
+		if (!pdirs[i])
+		{
+			pdirs[i] = phys;
+			nr_page_tables++;
+			spin_unlock(&vmm_lock, mask);
+			return phys;
+		}
 	}
 
-	if (dir == NULL)
-		kprintf("Error creating address space!\n");
-	
-	//memcpy(dir, kpage_dir, PAGE_DIR_SIZE);
-	return phys;
+	spin_unlock(&vmm_lock, mask);
+	kprintf("vmm_create_address_space: out of page directory slots!\n");
+	pmm_free(phys);
+	return 0;
 }
 
-void vmm_map_page(uintptr_t phys, uintptr_t virt, unsigned flags)
+/**
+ * @brief the kernel page directory
+ * @return physical address of the kernel's page directory
+ */
+uintptr_t vmm_kernel_address_space()
+{
+	return kernel_pdir;
+}
+
+/**
+ * @brief temporarily maps a physical page into kernel memory
+ * pages in the direct map are already mapped, so this only needs a kmap slot for pages above it
+ * @param phys physical address of the page
+ * @return virtual address the page is mapped to, until vmm_kunmap() is called on it
+ */
+void *vmm_kmap(uintptr_t phys)
+{
+	if (phys < direct_map_end)
+		return PHYS_TO_VIRT(phys);
+
+	int mask = spin_lock(&kmap_lock);
+
+	if (kmap_slots == 0xffffffff)
+	{
+		spin_unlock(&kmap_lock, mask);
+		kprintf("vmm_kmap: out of kmap slots!\n");
+		return NULL;
+	}
+
+	int slot = __builtin_ctz(~kmap_slots);
+	kmap_slots |= 1u << slot;
+
+	u32 *page_table = PAGE_TABLES + (KMAP_BASE >> 22) * PAGE_SIZE;
+	uintptr_t virt  = KMAP_BASE + slot * PAGE_SIZE;
+	page_table[slot] = (phys & ~(PAGE_SIZE - 1)) | PT_PRESENT | PT_WRITABLE;
+	invlpg(virt);
+
+	spin_unlock(&kmap_lock, mask);
+	return (void *) (virt + (phys & (PAGE_SIZE - 1)));
+}
+
+/**
+ * @brief removes a mapping made by vmm_kmap()
+ * @param ptr pointer returned by vmm_kmap()
+ */
+void vmm_kunmap(void *ptr)
+{
+	uintptr_t virt = (uintptr_t) ptr & ~(PAGE_SIZE - 1);
+	if (virt < KMAP_BASE)
+		return;
+
+	int slot = (virt - KMAP_BASE) / PAGE_SIZE;
+
+	int mask = spin_lock(&kmap_lock);
+	u32 *page_table = PAGE_TABLES + (KMAP_BASE >> 22) * PAGE_SIZE;
+	page_table[slot] = 0;
+	invlpg(virt);
+	kmap_slots &= ~(1u << slot);
+	spin_unlock(&kmap_lock, mask);
+}
+
+/**
+ * @brief maps a page in the current address space, adding a page table for it if needed
+ * @param phys physical address of the page
+ * @param virt virtual address to map it at
+ * @param flags PT_* flags of the mapping
+ * @return 0 on success, or -1 if there is no memory for a page table
+ */
+int vmm_map_page(uintptr_t phys, uintptr_t virt, unsigned flags)
 {
     unsigned long pdindex = virt >> 22;
     unsigned long ptindex = virt >> 12 & 0x3ff;
+    if (PAGE_DIR[pdindex] & PT_LARGE)
+    {
+        kprintf("vmm_map_page: 0x%x is inside a 4M page!\n", virt);
+        return -1;
+    }
+
+    // two cpus mustn't both add a page table for the same kernel page directory entry
+    int mask = spin_lock(&vmm_lock);
     if (!(PAGE_DIR[pdindex] & PT_PRESENT))
     {
-        kprintf("%d not present\n", pdindex);
-        uintptr_t new_page = pmm_alloc();
-        PAGE_DIR[pdindex] = new_page | flags;
+        uintptr_t new_page = pmm_alloc_zeroed();
+        if (new_page == (uintptr_t) -1)
+        {
+            spin_unlock(&vmm_lock, mask);
+            return -1;
+        }
+
+        PAGE_DIR[pdindex] = new_page | (flags & (PT_PRESENT | PT_WRITABLE | PT_USER));
+        nr_page_tables++;
+
+        // the recursive mapping may still have an old translation for the new page table
+        invlpg((uintptr_t) (PAGE_TABLES + pdindex * PAGE_SIZE));
+
+        if (is_kernel_pde(pdindex))
+            share_kernel_pde(pdindex);
     }
 
+    spin_unlock(&vmm_lock, mask);
+
+    // kernel memory looks the same from every address space
+    if (virt >= KERNEL_BASE && !(flags & PT_USER))
+        flags |= PT_GLOBAL;
+
     u32 *page_table = PAGE_TABLES + pdindex * PAGE_SIZE;
+    bool remap = page_table[ptindex] & PT_PRESENT;
     page_table[ptindex] = phys | flags;
+
+    // the tlb may still hold whatever used to be mapped here
+    if (remap)
+        invlpg(virt);
+
+    return 0;
+}
+
+/**
+ * @brief starts an empty batch of tlb invalidations
+ * @param batch batch to initialize
+ */
+void tlb_batch_init(struct tlb_batch *batch)
+{
+	batch->count  = 0;
+	batch->kernel = false;
+}
+
+/**
+ * @brief records a page whose translation has to be flushed from the tlb
+ * @param batch batch to add to
+ * @param virt virtual address of the page
+ */
+void tlb_batch_add(struct tlb_batch *batch, uintptr_t virt)
+{
+	// past the limit, the batch only needs to know a full flush is coming
+	if (batch->count < TLB_BATCH_MAX)
+		batch->addrs[batch->count] = virt;
+
+	batch->count++;
+
+	if (virt >= KERNEL_BASE)
+		batch->kernel = true;
+}
+
+/**
+ * @brief flushes every page recorded in a batch from the tlb, then empties it
+ * a small batch is flushed with one invlpg per page. once a batch is large enough that
+ * refilling the whole tlb is cheaper, the entire tlb is flushed at once instead
+ * @param batch batch to flush
+ */
+void tlb_batch_flush(struct tlb_batch *batch)
+{
+	u32 cr4;
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+
+	if (batch->count <= TLB_BATCH_MAX)
+	{
+		for (uint i = 0; i < batch->count; i++)
+			invlpg(batch->addrs[i]);
+	}
+
+	// reloading cr3 leaves global pages alone, so kernel pages need
+	// cr4.pge toggled, which flushes every entry, global or not
+	else if (batch->kernel && (cr4 & 0x80))
+	{
+		asm volatile("mov %0, %%cr4" :: "r"(cr4 & ~0x80) : "memory");
+		asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+	}
+
+	else
+		asm volatile("mov %0, %%cr3" :: "r"(read_cr3()) : "memory");
+
+	tlb_batch_init(batch);
+}
+
+/**
+ * @brief clears a page table entry in the current address space, without touching the tlb
+ * @param virt virtual address of the page
+ * @return physical address the page was mapped to, or 0 if it was not mapped
+ */
+static uintptr_t clear_pte(uintptr_t virt)
+{
+	u32 *pte = get_pte(virt);
+	if (!pte || !(*pte & PT_PRESENT))
+		return 0;
+
+	uintptr_t phys = *pte & PT_FRAME;
+	*pte = 0;
+	return phys;
+}
+
+/**
+ * @brief removes a page from the current address space
+ * the frame it was mapped to is left alone, and is the caller's to free
+ * @param virt virtual address of the page
+ * @return physical address the page was mapped to, or 0 if it was not mapped
+ */
+uintptr_t vmm_unmap_page(uintptr_t virt)
+{
+	uintptr_t phys = clear_pte(virt & ~(PAGE_SIZE - 1));
+	if (phys)
+		invlpg(virt);
+
+	return phys;
+}
+
+/**
+ * @brief removes every page in a range from the current address space, and drops
+ * the reference each one held on its frame, freeing frames nothing else shares.
+ * the tlb is flushed once at the end, rather than once per page
+ * @param start virtual address of the first page
+ * @param end virtual address one past the last byte of the range
+ */
+void vmm_unmap_range(uintptr_t start, uintptr_t end)
+{
+	struct tlb_batch batch;
+	tlb_batch_init(&batch);
+
+	uintptr_t virt = start & ~(PAGE_SIZE - 1);
+	while (virt < end)
+	{
+		// skip the whole 4M a missing page table would have mapped
+		u32 pde = PAGE_DIR[virt >> 22];
+		if (!(pde & PT_PRESENT) || (pde & PT_LARGE))
+		{
+			if (pde & PT_LARGE)
+				kprintf("vmm_unmap_range: 0x%x is inside a 4M page!\n", virt);
+
+			virt = (virt & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+			if (virt == 0)
+				break;
+
+			continue;
+		}
+
+		uintptr_t phys = clear_pte(virt);
+		if (phys)
+		{
+			pmm_free(phys);
+			tlb_batch_add(&batch, virt);
+		}
+
+		virt += PAGE_SIZE;
+	}
+
+	tlb_batch_flush(&batch);
+}
+
+/**
+ * @brief maps a 4M page, which takes a single page directory entry and a single tlb entry
+ * instead of a page table and up to 1024 tlb entries. on cpus without pse, it is mapped as 1024 4K pages instead
+ * @param phys physical address of the page, 4M aligned
+ * @param virt virtual address to map it at, 4M aligned
+ * @param flags PT_* flags of the mapping
+ */
+void vmm_map_large_page(uintptr_t phys, uintptr_t virt, unsigned flags)
+{
+	if ((phys | virt) & (LARGE_PAGE_SIZE - 1))
+	{
+		kprintf("vmm_map_large_page: 0x%x -> 0x%x is not 4M aligned!\n", virt, phys);
+		return;
+	}
+
+	if (!has_pse)
+	{
+		for (uint off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE)
+			vmm_map_page(phys + off, virt + off, flags);
+
+		return;
+	}
+
+	unsigned long pdindex = virt >> 22;
+	bool replaced = PAGE_DIR[pdindex] & PT_PRESENT;
+
+	if (is_kernel_pde(pdindex) && !(flags & PT_USER))
+		flags |= PT_GLOBAL;
+
+	// a page table this replaces is left to its owner to free
+	PAGE_DIR[pdindex] = phys | flags | PT_LARGE;
+
+	// and the tlb may still hold 4K entries from it
+	if (replaced)
+	{
+		for (uint off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE)
+			invlpg(virt + off);
+	}
+
+	if (is_kernel_pde(pdindex))
+		share_kernel_pde(pdindex);
+}
+
+/**
+ * @brief copies a newly created kernel page directory entry from the current
+ * address space into every other one, so kernel memory stays shared between all of them
+ * @param pdindex index of the page directory entry
+ */
+static void share_kernel_pde(int pdindex)
+{
+	uintptr_t cr3 = read_cr3();
+
+	int mask = spin_lock(&vmm_lock);
+	for (int i = 0; i < NPROC + 1; i++)
+	{
+		if (!pdirs[i] || pdirs[i] == cr3)
+			continue;
+
+		u32 *dir = vmm_kmap(pdirs[i]);
+		dir[pdindex] = PAGE_DIR[pdindex];
+		vmm_kunmap(dir);
+	}
+
+	spin_unlock(&vmm_lock, mask);
+}
+
+/**
+ * @brief adds a region of user memory to a process
+ * nothing is mapped until the region's pages are touched
+ * @param pptr process to add the region to
+ * @param start address of the first byte of the region, rounded down to a page
+ * @param end address one past the last byte of the region, rounded up to a page
+ * @param flags VM_* flags describing the region
+ * @return the new region, or NULL if it overlaps an existing region
+ */
+struct vm_region *vmm_add_region(struct proc *pptr, uintptr_t start, uintptr_t end, unsigned flags)
+{
+	start = start & ~(PAGE_SIZE - 1);
+	end   = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	if (start >= end || start < USER_BASE || end > KERNEL_BASE)
+		return NULL;
+
+	// find the region the new one goes after, keeping the list sorted
+	struct vm_region **link = &pptr->regions;
+	while (*link && (*link)->end <= start)
+		link = &(*link)->next;
+
+	if (*link && (*link)->start < end)
+	{
+		kprintf("vmm_add_region: 0x%x-0x%x overlaps an existing region!\n", start, end);
+		return NULL;
+	}
+
+	struct vm_region *region = kmem_cache_alloc(region_cache);
+	region->start = start;
+	region->end   = end;
+	region->flags = flags;
+	region->next  = *link;
+	*link         = region;
+
+	return region;
+}
+
+/**
+ * @brief finds the region of a process that contains an address
+ * @param pptr process to search
+ * @param addr user address
+ * @return the region containing addr, or NULL if addr is not in any region
+ */
+struct vm_region *vmm_find_region(struct proc *pptr, uintptr_t addr)
+{
+	for (struct vm_region *region = pptr->regions; region && region->start <= addr; region = region->next)
+	{
+		if (addr < region->end)
+			return region;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief makes a region of the current process read only, including the pages already mapped in it
+ * @param region region to protect
+ */
+void vmm_protect_region(struct vm_region *region)
+{
+	struct tlb_batch batch;
+	tlb_batch_init(&batch);
+
+	region->flags &= ~VM_WRITE;
+	for (uintptr_t virt = region->start; virt < region->end; virt += PAGE_SIZE)
+	{
+		if (!(PAGE_DIR[virt >> 22] & PT_PRESENT))
+			continue;
+
+		u32 *pte = get_pte(virt);
+		if (*pte & PT_WRITABLE)
+		{
+			*pte &= ~PT_WRITABLE;
+			tlb_batch_add(&batch, virt);
+		}
+	}
+
+	tlb_batch_flush(&batch);
+}
+
+/**
+ * @brief gives a process a copy of the current process's address space
+ * no memory is actually copied. instead, every frame is shared between the two, and writable
+ * pages are made read only and marked copy on write in both, so that whichever process
+ * writes to a page first gets its own copy of it in the page fault handler
+ * @param parent process whose address space to copy, must be the current process
+ * @param child process that receives the copy
+ * @return 0 on success, or -1 if out of memory
+ */
+int vmm_clone_address_space(struct proc *parent, struct proc *child)
+{
+	uintptr_t pdir = vmm_create_address_space();
+	if (!pdir)
+		return -1;
+
+	child->pdir    = pdir;
+	child->regions = NULL;
+
+	for (struct vm_region *region = parent->regions; region; region = region->next)
+		vmm_add_region(child, region->start, region->end, region->flags);
+
+	u32 *child_dir = vmm_kmap(child->pdir);
+
+	// every page of the parent that becomes read only has to be flushed from its tlb
+	struct tlb_batch batch;
+	tlb_batch_init(&batch);
+
+	for (uint pdindex = USER_BASE >> 22; pdindex < KERNEL_BASE >> 22; pdindex++)
+	{
+		if (!(PAGE_DIR[pdindex] & PT_PRESENT))
+			continue;
+
+		uintptr_t table = pmm_alloc();
+		if (table == (uintptr_t) -1)
+		{
+			vmm_kunmap(child_dir);
+			tlb_batch_flush(&batch);
+			return -1;
+		}
+
+		u32 *parent_table = PAGE_TABLES + pdindex * PAGE_SIZE;
+		u32 *child_table  = vmm_kmap(table);
+
+		for (int i = 0; i < NUM_TABLE_ENTRIES; i++)
+		{
+			u32 pte = parent_table[i];
+			if (!(pte & PT_PRESENT))
+			{
+				child_table[i] = 0;
+				continue;
+			}
+
+			if (pte & PT_WRITABLE)
+			{
+				pte = (pte & ~PT_WRITABLE) | PT_COW;
+				tlb_batch_add(&batch, (pdindex << 22) | (i << 12));
+			}
+
+			parent_table[i] = pte;
+			child_table[i]  = pte;
+			pmm_ref(pte & PT_FRAME);
+		}
+
+		vmm_kunmap(child_table);
+		child_dir[pdindex] = table | PT_PRESENT | PT_WRITABLE | PT_USER;
+
+		int mask = spin_lock(&vmm_lock);
+		nr_page_tables++;
+		spin_unlock(&vmm_lock, mask);
+	}
+
+	vmm_kunmap(child_dir);
+	tlb_batch_flush(&batch);
+	return 0;
+}
+
+/**
+ * @brief frees every user page, page table, and region of a process, then its page directory
+ * @param pptr process whose address space to destroy
+ */
+void vmm_destroy_address_space(struct proc *pptr)
+{
+	uintptr_t pdir = pptr->pdir;
+	if (pdir == kernel_pdir)
+		return;
+
+	// stop using the address space before tearing it down
+	pptr->pdir = kernel_pdir;
+	if (read_cr3() == pdir)
+		asm volatile("mov %0, %%cr3" :: "r"(kernel_pdir) : "memory");
+
+	// the page directory itself, plus each page table freed below
+	uint tables = 1;
+
+	u32 *dir = vmm_kmap(pdir);
+	for (uint pdindex = USER_BASE >> 22; pdindex < KERNEL_BASE >> 22; pdindex++)
+	{
+		if (!(dir[pdindex] & PT_PRESENT))
+			continue;
+
+		u32 *table = vmm_kmap(dir[pdindex] & PT_FRAME);
+		for (int i = 0; i < NUM_TABLE_ENTRIES; i++)
+		{
+			if (table[i] & PT_PRESENT)
+				pmm_free(table[i] & PT_FRAME);
+		}
+
+		vmm_kunmap(table);
+		pmm_free(dir[pdindex] & PT_FRAME);
+		tables++;
+	}
+
+	vmm_kunmap(dir);
+
+	int mask = spin_lock(&vmm_lock);
+	for (int i = 0; i < NPROC + 1; i++)
+	{
+		if (pdirs[i] == pdir)
+			pdirs[i] = 0;
+	}
+
+	nr_page_tables -= tables;
+
+	spin_unlock(&vmm_lock, mask);
+	pmm_free(pdir);
+
+	while (pptr->regions)
+	{
+		struct vm_region *region = pptr->regions;
+		pptr->regions = region->next;
+		kmem_cache_free(region_cache, region);
+	}
+}
+
+/**
+ * @brief fills in the page table counters of a meminfo
+ * @param info meminfo to fill in
+ */
+void vmm_meminfo(struct meminfo *info)
+{
+	info->page_table_pages = nr_page_tables;
+}
+
+/**
+ * @brief counts the user pages currently mapped into a process's address space
+ * a page shared with another process (copy on write) counts towards both of them
+ * @param pptr process to count
+ * @return number of resident user pages
+ */
+uint vmm_resident_pages(struct proc *pptr)
+{
+	uint pages = 0;
+
+	// keep the process from exiting and freeing its page tables out from under us, see proc_exit()
+	int mask = spin_lock(&sched_lock);
+	if (pptr->pdir == kernel_pdir)
+	{
+		spin_unlock(&sched_lock, mask);
+		return 0;
+	}
+
+	u32 *dir = vmm_kmap(pptr->pdir);
+	for (uint pdindex = USER_BASE >> 22; pdindex < KERNEL_BASE >> 22; pdindex++)
+	{
+		if (!(dir[pdindex] & PT_PRESENT))
+			continue;
+
+		u32 *table = vmm_kmap(dir[pdindex] & PT_FRAME);
+		for (int i = 0; i < NUM_TABLE_ENTRIES; i++)
+		{
+			if (table[i] & PT_PRESENT)
+				pages++;
+		}
+
+		vmm_kunmap(table);
+	}
+
+	vmm_kunmap(dir);
+	spin_unlock(&sched_lock, mask);
+	return pages;
+}
+
+/**
+ * @brief moves a process's program break, growing or shrinking its heap region.
+ * new heap pages are mapped on first touch, like any other region, and pages
+ * the heap shrinks away from are unmapped and freed right away
+ * @param pptr process whose break to move, must be the current process
+ * @param addr new program break
+ * @return the new program break, or the old one if addr is out of range
+ */
+uintptr_t vmm_brk(struct proc *pptr, uintptr_t addr)
+{
+	// checked before rounding up, which would wrap an address in the last page to 0
+	if (addr < pptr->brk_start || addr > KERNEL_BASE)
+		return pptr->brk;
+
+	uintptr_t old_end = (pptr->brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	uintptr_t new_end = (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	// the heap region only exists while the heap is not empty
+	struct vm_region *heap = old_end > pptr->brk_start ? vmm_find_region(pptr, pptr->brk_start) : NULL;
+
+	if (new_end > old_end)
+	{
+		if (!heap)
+		{
+			if (!vmm_add_region(pptr, pptr->brk_start, new_end, VM_READ | VM_WRITE))
+				return pptr->brk;
+		}
+
+		else if (heap->next && new_end > heap->next->start)
+			return pptr->brk;
+
+		else
+			heap->end = new_end;
+	}
+
+	else if (new_end < old_end)
+	{
+		vmm_unmap_range(new_end, old_end);
+		heap->end = new_end;
+
+		if (heap->start == heap->end)
+		{
+			struct vm_region **link = &pptr->regions;
+			while (*link != heap)
+				link = &(*link)->next;
+
+			*link = heap->next;
+			kmem_cache_free(region_cache, heap);
+		}
+	}
+
+	pptr->brk = addr;
+	return addr;
+}
+
+/**
+ * @brief extends a stack region down to cover an address just below it
+ * @param pptr process whose stack to grow
+ * @param addr faulting address
+ * @return the grown stack region, or NULL if addr is not just below a stack
+ */
+static struct vm_region *grow_stack(struct proc *pptr, uintptr_t addr)
+{
+	// the stack is the first region above the fault, since regions are sorted
+	struct vm_region *prev   = NULL;
+	struct vm_region *region = pptr->regions;
+	while (region && region->end <= addr)
+	{
+		prev   = region;
+		region = region->next;
+	}
+
+	if (!region || !(region->flags & VM_GROWSDOWN))
+		return NULL;
+
+	if (region->end - (addr & ~(PAGE_SIZE - 1)) > USTACK_MAX)
+		return NULL;
+
+	// and it can't grow into the region below it (the heap, usually)
+	if (prev && prev->end > (addr & ~(PAGE_SIZE - 1)))
+		return NULL;
+
+	region->start = addr & ~(PAGE_SIZE - 1);
+	return region;
+}
+
+/**
+ * @brief gives the current process its own writable copy of a copy on write page
+ * @param addr faulting address
+ * @param pte page table entry of the faulting page
+ * @return true if the page is now writable
+ */
+static bool break_cow(uintptr_t addr, u32 *pte)
+{
+	uintptr_t page = addr & ~(PAGE_SIZE - 1);
+	uintptr_t phys = *pte & PT_FRAME;
+
+	// when every other process has already made its own copy, the frame can just be taken back
+	if (pmm_refcount(phys) > 1)
+	{
+		uintptr_t copy = pmm_alloc();
+		if (copy == (uintptr_t) -1)
+			return false;
+
+		void *dst = vmm_kmap(copy);
+		memcpy(dst, (void *) page, PAGE_SIZE);
+		vmm_kunmap(dst);
+
+		pmm_free(phys);
+		phys = copy;
+	}
+
+	*pte = phys | (*pte & (PT_PRESENT | PT_USER)) | PT_WRITABLE;
+	invlpg(page);
+	return true;
+}
+
+/**
+ * @brief tries to resolve a page fault
+ * faults on pages of a process's regions that have never been touched are resolved by
+ * mapping in a zeroed frame, faults just below the user stack grow the stack,
+ * and writes to copy on write pages copy the page
+ * @param regs state of the registers when the fault occurred
+ * @param addr address the fault was on
+ * @return true if the fault was resolved and the faulting instruction can be restarted
+ */
+static bool resolve_fault(struct registers *regs, uintptr_t addr)
+{
+	if (addr >= KERNEL_BASE)
+		return false;
+
+	// a protection violation on a page that is already present is only
+	// fixable if it was a write to a copy on write page
+	if (regs->error_code & PF_PRESENT)
+	{
+		u32 *pte = get_pte(addr);
+		if (!pte || !(regs->error_code & PF_WRITE) || !(*pte & PT_COW))
+			return false;
+
+		return break_cow(addr, pte);
+	}
+
+	struct vm_region *region = vmm_find_region(curr, addr);
+	if (!region)
+		region = grow_stack(curr, addr);
+
+	if (!region)
+		return false;
+
+	if ((regs->error_code & PF_WRITE) && !(region->flags & VM_WRITE))
+		return false;
+
+	// the frame has to be zeroed before the process can see it, so no other process's data leaks into it
+	uintptr_t phys = pmm_alloc_zeroed();
+	if (phys == (uintptr_t) -1)
+		return false;
+
+	unsigned flags = PT_PRESENT | PT_USER;
+	if (region->flags & VM_WRITE)
+		flags |= PT_WRITABLE;
+
+	if (vmm_map_page(phys, addr & ~(PAGE_SIZE - 1), flags) != 0)
+	{
+		pmm_free(phys);
+		return false;
+	}
+
+	return true;
 }
 
 /**
  * @brief page fault handler
+ * a fault that can't be resolved kills the process if it came from user mode,
+ * and is left to panic the kernel if it came from the kernel itself
+ * @param regs state of the registers when the fault occurred
+ * @return true if the fault was resolved and the faulting instruction can be restarted
  */
-static void page_fault()
+static bool page_fault(struct registers *regs)
 {
-	kprintf("Page fault detected!\n");
-	while (1) ;
+	uintptr_t addr;
+	asm("mov %%cr2, %0" : "=r"(addr));
+
+	if (resolve_fault(regs, addr))
+		return true;
+
+	// the cpu pushes cs right after eip, and its low bits are the ring the fault came from
+	u32 cs = *(&regs->eip + 1);
+	if (cs & 3)
+	{
+		kprintf("%s (pid = %d): segmentation fault at 0x%x\n", curr->name, curr->pid, addr);
+		proc_exit(-1);
+	}
+
+	return false;
 }
@@ -0,0 +1,123 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: workqueue.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: deferred work that runs in process context
+ *
+ * Work is queued from anywhere, including hardware interrupt handlers, and run in order by the
+ * worker thread. Since it runs in a thread, work is free to do anything a process can, like
+ * waking processes up, taking the kernel lock, or blocking.
+ *
+ * Queueing work that is already pending does nothing, so an interrupt that fires many times
+ * before its work gets to run only runs it once. The work has to handle everything that
+ * arrived since it last ran.
+ */
+#include <workqueue.h>
+
+#include <proc.h>
+#include <spinlock.h>
+
+// work waiting to run
+static struct queue workq;
+
+// thread that runs queued work
+static struct proc *kworker;
+
+// true while kworker is waiting for work. work may block, so its state alone can't tell. protected by sched_lock
+static bool worker_idle;
+
+// protects workq. never taken before sched_lock, only after it
+static struct spinlock work_lock = SPINLOCK_INIT("work");
+
+static int worker_thread(void *);
+
+/**
+ * @brief starts the worker thread
+ */
+void workqueue_init()
+{
+	queue_init(&workq);
+	kworker = kthread_create(worker_thread, NULL, "kworker");
+}
+
+/**
+ * @brief initializes work, which starts out not pending
+ * @param w work to initialize
+ * @param func function to call when the work runs
+ * @param arg argument to pass to func
+ */
+void work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->pending = false;
+	w->func    = func;
+	w->arg     = arg;
+}
+
+/**
+ * @brief queues work for the worker thread to run
+ * @param w work to queue
+ * @return false if the work was already pending
+ */
+bool queue_work(struct work *w)
+{
+	int mask  = spin_lock(&sched_lock);
+	int wmask = spin_lock(&work_lock);
+	if (w->pending)
+	{
+		spin_unlock(&work_lock, wmask);
+		spin_unlock(&sched_lock, mask);
+		return false;
+	}
+
+	w->pending = true;
+	insert(&workq, &w->link);
+	spin_unlock(&work_lock, wmask);
+
+	// the worker checks for work and goes to sleep all under sched_lock, so it can't miss this
+	if (worker_idle)
+	{
+		worker_idle = false;
+		ready(kworker);
+	}
+
+	spin_unlock(&sched_lock, mask);
+	return true;
+}
+
+/**
+ * @brief body of the worker thread, which runs queued work in order and waits for more. never returns
+ */
+static int worker_thread(void *arg)
+{
+	(void) arg;
+	while (1)
+	{
+		int mask  = spin_lock(&sched_lock);
+		int wmask = spin_lock(&work_lock);
+
+		struct qnode *node;
+		while ((node = dequeue(&workq)))
+		{
+			struct work *w = queue_entry(node, struct work, link);
+			w->pending = false;
+
+			// the work is no longer pending, so it may be queued again while it runs
+			spin_unlock(&work_lock, wmask);
+			spin_unlock(&sched_lock, mask);
+			w->func(w->arg);
+			mask  = spin_lock(&sched_lock);
+			wmask = spin_lock(&work_lock);
+		}
+
+		spin_unlock(&work_lock, wmask);
+		worker_idle = true;
+		this_cpu()->proc->state = PR_WAITING;
+		sched();
+		spin_unlock(&sched_lock, mask);
+	}
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: user/mbench/mbench.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: mbench - malloc/free microbenchmark
+ *
+ * Each test prints the average number of cpu cycles, as measured by rdtsc,
+ * spent in one malloc() + free() pair.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// number of malloc/free pairs timed by each test
+#define ITERATIONS 10000
+
+// number of blocks live at once in the batch tests
+#define BATCH 256
+
+static inline uint64_t rdtsc()
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+static void *blocks[BATCH];
+
+// tiny lcg so the mixed test is repeatable from run to run
+static uint32_t seed = 1;
+static uint32_t next_rand()
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+// libc has no 64 bit division, so cycle counts are truncated to 32 bits before averaging
+static void report(const char *name, uint64_t cycles, int ops)
+{
+	printf("%s: %d cycles/op\n", name, (uint32_t) cycles / ops);
+}
+
+// malloc then immediately free the same size, the best case for any allocator
+static void bench_pair(size_t size)
+{
+	uint64_t t0 = rdtsc();
+	for (int i = 0; i < ITERATIONS; i++)
+		free(malloc(size));
+	uint64_t t1 = rdtsc();
+
+	printf("size %d ", size);
+	report("pair", t1 - t0, ITERATIONS);
+}
+
+// many small blocks live at once, freed in allocation order
+static void bench_batch(size_t size)
+{
+	uint64_t t0 = rdtsc();
+	for (int i = 0; i < ITERATIONS / BATCH; i++)
+	{
+		for (int j = 0; j < BATCH; j++)
+			blocks[j] = malloc(size);
+
+		for (int j = 0; j < BATCH; j++)
+			free(blocks[j]);
+	}
+	uint64_t t1 = rdtsc();
+
+	printf("size %d ", size);
+	report("batch", t1 - t0, ITERATIONS / BATCH * BATCH);
+}
+
+// random sizes up to 64K freed in random order, which exercises coalescing and the large freelists
+static void bench_mixed()
+{
+	for (int i = 0; i < BATCH; i++)
+		blocks[i] = NULL;
+
+	uint64_t t0 = rdtsc();
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		int j = next_rand() % BATCH;
+		free(blocks[j]);
+		blocks[j] = malloc(next_rand() % (64 * 1024) + 1);
+	}
+	uint64_t t1 = rdtsc();
+
+	for (int i = 0; i < BATCH; i++)
+		free(blocks[i]);
+
+	report("mixed", t1 - t0, ITERATIONS);
+}
+
+int main()
+{
+	bench_pair(16);
+	bench_pair(128);
+	bench_pair(4096);
+
+	bench_batch(16);
+	bench_batch(128);
+
+	bench_mixed();
+	return 0;
+}
@@ -0,0 +1,50 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: user/meminfo/meminfo.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: meminfo - display kernel memory usage
+ *
+ * usage: meminfo [pid]
+ * resident pages are reported for pid, or for meminfo itself if no pid is given
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/meminfo.h>
+
+int main(int argc, char **argv)
+{
+	pid_t pid = argc > 1 ? atoi(argv[1]) : -1;
+	struct meminfo info;
+
+	if (meminfo(&info, pid) != 0)
+	{
+		printf("meminfo: no process %d\n", pid);
+		return 1;
+	}
+
+	printf("frames: %d total, %d used, %d free (%d zeroed)\n",
+	       info.total_frames,
+	       info.used_frames,
+	       info.free_frames,
+	       info.zeroed_frames);
+	printf("page tables: %d pages\n", info.page_table_pages);
+
+	printf("kmalloc: %d byte heap\n", info.kheap_size);
+	for (int i = 0; i < KMALLOC_NCLASSES; i++)
+	{
+		if (i < KMALLOC_NCLASSES - 1)
+			printf("  <= %d: ", KMALLOC_CLASS_MIN << i);
+		else
+			printf("  larger: ");
+
+		printf("%d bytes in %d blocks\n", info.kmalloc_bytes[i], info.kmalloc_count[i]);
+	}
+
+	printf("slab: %d caches, %d pages, %d bytes in use\n", info.slab_caches, info.slab_pages, info.slab_bytes);
+	printf("resident: %d pages\n", info.resident_pages);
+	return 0;
+}
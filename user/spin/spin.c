@@ -0,0 +1,25 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: user/spin/spin.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: spin - burns a fixed amount of cpu time, then exits
+ *
+ * The scheduler benchmark in the kernel (bench.c, built with `make BENCH=1`) runs several of
+ * these at once, and times how long they take to finish as the number of them grows.
+ */
+
+// number of times the loop runs, enough to take a good fraction of a second
+#define SPIN_LOOPS 50000000
+
+int main()
+{
+	// volatile, so the compiler can't fold the loop away
+	volatile unsigned sum = 0;
+	for (unsigned i = 0; i < SPIN_LOOPS; i++)
+		sum += i;
+
+	return 0;
+}